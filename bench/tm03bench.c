@@ -0,0 +1,144 @@
+/*
+
+  Time the word <-> tape frame conversions in tm03.c, for "make bench".
+
+  Runs decrec() and encrec() over 1024-word records of random words for
+  9-track (TM03) and 7-track tapes, using the same codec itstar would pick
+  on this CPU, and prints the cost per word.  "read" goes through
+  taperead() and inwords() the way itstar reads a tape, with the 7-track
+  parity check that -p turns on.  The records are also checked to come
+  back as they went in.
+
+  Usage:  tm03bench [passes]
+
+  This file is part of itstar.
+
+  itstar is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  itstar is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with itstar.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../itstar.h"
+
+#define WORDS 1024		/* words per record, as in tm03.c */
+#define NRECS 64		/* records converted per pass */
+
+/* what tm03.c wants from the rest of itstar */
+int seven_track=0;
+int checkparity=0;
+int blocking=1;
+extern unsigned long parerrs;
+
+static char *rec;		/* the record being converted */
+
+void nomem()
+{
+	perror("?Error allocating memory");
+	exit(1);
+}
+
+int getrecp(char **bufp,int len)
+{
+	*bufp=rec;
+	return(len);
+}
+
+void putrec(char *buf,int len) { }
+void skipmark() { }
+long long recoffset() { return(0); }
+
+static double now();
+static void bench(char *name,int passes);
+
+int main(int argc,char **argv)
+{
+	int passes=argc>1?atoi(argv[1]):2000;
+
+	if(passes<=0) {
+		fprintf(stderr,"Usage:  tm03bench [passes]\n");
+		exit(1);
+	}
+	seven_track=0;
+	bench("9-track",passes);
+	seven_track=1;
+	bench("7-track",passes);
+	return(0);
+}
+
+/* time PASSES passes over NRECS records with the current codec */
+static void bench(char *name,int passes)
+{
+	static uint64_t w[NRECS][WORDS], v[WORDS];
+	static char frames[NRECS][6*WORDS];
+	double t, enc, dec, decp;
+	int i, j, len=0;
+
+	pickcodec();
+	srandom(1);
+	for(i=0;i<NRECS;i++)
+		for(j=0;j<WORDS;j++)
+			w[i][j]=(((uint64_t)random()<<32)^random())&
+				0777777777777ULL;
+
+	t=now();			/* words to frames */
+	for(i=0;i<passes;i++)
+		for(j=0;j<NRECS;j++) len=encrec(w[j],WORDS,frames[j]);
+	enc=now()-t;
+
+	for(j=0;j<NRECS;j++) {		/* make sure they come back */
+		decrec(frames[j],len,v);
+		if(memcmp(v,w[j],sizeof(v))!=0) {
+			fprintf(stderr,"?%s record %d doesn't match\n",name,j);
+			exit(1);
+		}
+	}
+
+	t=now();			/* frames to words */
+	for(i=0;i<passes;i++)
+		for(j=0;j<NRECS;j++) decrec(frames[j],len,v);
+	dec=now()-t;
+
+	checkparity=1;			/* same, with parity check if any */
+	t=now();
+	for(i=0;i<passes;i++)
+		for(j=0;j<NRECS;j++) {
+			rec=frames[j];
+			taperead();
+			inwords(v,WORDS);
+		}
+	decp=now()-t;
+	checkparity=0;
+	if(parerrs) {
+		fprintf(stderr,"?%s parity errors:  %lu\n",name,parerrs);
+		exit(1);
+	}
+
+	t=1e9/((double)passes*NRECS*WORDS);
+	printf("%s  encode %6.2f  decode %6.2f  read %6.2f  ns/word\n",name,
+		enc*t,dec*t,decp*t);
+}
+
+/* return the time in seconds */
+static double now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return(ts.tv_sec+ts.tv_nsec/1e9);
+}
@@ -2,6 +2,17 @@
 
   Read DIR.LIST to get file parameters.
 
+  The whole file is read into memory and parsed in one pass, with the Lisp
+  dates done in 64-bit arithmetic.  Errors are reported with the byte offset
+  in DIR.LIST where parsing stopped.
+
+  With -k, the parsed entries (names, link targets, dates already converted
+  to UNIX times, and authors) are also saved in a cache directory, in one
+  file per DIR.LIST with fixed-length little-endian records, keyed by the
+  DIR.LIST's full pathname, size and modification time.  The next run that
+  finds the same DIR.LIST unchanged maps the cache file instead of reading
+  (and maybe decompressing) and parsing DIR.LIST again.
+
   By John Wilson.
 
   08/09/1993  JMBW  Created.
@@ -27,256 +38,538 @@
 #define zopen apple_zopen
 #include <stdio.h>
 #undef zopen
+#include <stdint.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <time.h>
+#include <unistd.h>
 
 #include "itstar.h"
 
 FILE *zopen(char *);
 void nomem();
 
-static FILE *dir;
-
-static int eat(char c), string(char *, int), number();
-static void file(char *), punt(), numhuge(char *, int), subhuge(char *, char *,int);
-static time_t valhuge(char *, int);
+/* the whole DIR.LIST is read into memory (uncompressed) and parsed there */
+static char *buf;		/* contents, with a NUL after the end */
+static char *end;		/* end of contents */
+static char *ptr;		/* next char to parse */
+static char *listname;		/* its name, for error messages */
+
+struct entry {			/* one file from DIR.LIST */
+	char fn1[8], fn2[8], author[8];  /* (NUL padded) */
+	char lufd[8], lfn1[8], lfn2[8];  /* link target if ISLINK */
+	int islink;
+	int64_t cdate, rdate;	/* UNIX times, NODATE if none */
+};
+#define NODATE INT64_MIN
+
+static struct entry *ents=NULL;	/* entries from the DIR.LIST being read */
+static unsigned long nents, maxents;
+
+/* cache file format, see loadcache() and savecache() */
+#define MAGIC "ITSDLC\0\1"	/* magic number and version */
+#define HDRLEN 48		/* length of header (before pathname) */
+#define ENTLEN 72		/* length of each entry */
+
+static char *cachedir=NULL;	/* -k directory, NULL if not caching */
+
+static int eat(int), string(char *, int), nil(),
+	liststat(char *, struct stat *, char **), terminated(unsigned char *);
+static int loadcache(char *, char *, struct stat *);
+static void skip(), parse(FILE *), savecache(char *, char *, struct stat *);
+static long number();
+static int64_t bignum();
+static void file(), use(char *, struct entry *), punt(char *);
+static int64_t getdate();
+static char *cachename(char *);
+static void put32(FILE *, unsigned long), put64(FILE *, uint64_t);
+static unsigned long get32(unsigned char *);
+static uint64_t get64(unsigned char *);
 
 extern char dev[7], ufd[7], fn1[7], fn2[7], author[7],
 	lufd[7], lfn1[7], lfn2[7];
 extern long islink;
 extern struct tm cdate, rdate;
 
-/* Date correction is done in decimal math to avoid overflow on 32-bit CPUs */
 /* DIR.LIST has Common Lisp times which are seconds since midnight UTC on */
 /* 01-Jan-1900.  WEENIX time began at midnight UTC on 01-Jan-1970. */
 /* N.B. 1900 was not a leap year so only 17 leap years before 1970, so the */
 /* offset is (70*365+17)*86400 = 2208988800 */
-/* (appears backwards in array since lispoffset[0] = least significant digit) */
-static char lispoffset[16] = { 0,0,8,8,8,9,8,0,2,2,0,0,0,0,0,0 };
-#define LISPLEN sizeof(lispoffset)
+#define LISPOFFSET INT64_C(2208988800)
+
+/* cache parsed DIR.LIST files in directory D (for -k) */
+void dircache(char *d)
+{
+	/* (get its full name now, so -C doesn't change it) */
+	if((cachedir=realpath(d,NULL))==NULL) {
+		perror(d);
+		exit(1);
+	}
+}
 
 /* process a DIR.LIST file, if one exists */
 /* output buffer must have been initialized with resetbuf() */
 int dirlist(int argc,char **argv,char *d)
 {
+	struct stat s;
+	char *cache=NULL, *found;
+	unsigned long i;
+	FILE *f;
+
 	char *name=malloc(strlen(d)+1+8+1);  /* dir name, /, DIR.LIST, NUL */
 	if(name==NULL) nomem();
 	sprintf(name,"%s/DIR.LIST",d);	/* compose name */
-	dir=zopen(name);		/* uncompress/open dir list */
+	if(liststat(name,&s,&found)<0) {  /* no luck, do our own dir search */
+		free(name);
+		return(-1);
+	}
+
+	nents=0;
+	if(cachedir) cache=cachename(d);
+	if(cache==NULL||!loadcache(cache,found,&s)) {
+		if((f=zopen(name))==NULL) {  /* uncompress/open dir list */
+			perror(name);
+			exit(1);
+		}
+		listname=name;
+		parse(f);
+		if(cache) savecache(cache,found,&s);
+	}
+
+	/* now save the files */
+	for(i=0;i<nents;i++) use(d,&ents[i]);
+
+	free(cache);
+	free(found);
 	free(name);
-	if(dir==NULL) return(-1);	/* no luck, do our own dir search */
+	return(0);			/* success */
+}
+
+/* set *S to the status of DIR.LIST NAME, or of NAME.Z or NAME.gz if it's */
+/* compressed (the same ones zopen() looks for), and *FOUND to the name of */
+/* the one that exists (malloc()ed), return -1 if none exists */
+static int liststat(char *name,struct stat *s,char **found)
+{
+	static char *sfx[]={ "", ".Z", ".gz" };
+	char *p;
+	int i, r;
+
+	if((p=malloc(strlen(name)+3+1))==NULL) nomem();
+	for(i=0;i<3;i++) {
+		sprintf(p,"%s%s",name,sfx[i]);
+		if((r=stat(p,s))==0) break;
+	}
+	if(r<0) free(p);
+	else *found=p;
+	return(r);
+}
 
-	eat('(');
+/* parse DIR.LIST, open as F, into ents[] */
+static void parse(FILE *f)
+{
+	size_t len, max, n;
+
+	/* read it all in */
+	for(len=0,max=64*1024,buf=NULL;;len+=n) {
+		if((buf=realloc(buf,max+1))==NULL) nomem();
+		if((n=fread(buf+len,1,max-len,f))==0) break;
+		if(len+n==max) max*=2;
+	}
+	if(ferror(f)) {
+		perror("?Error reading DIR.LIST");
+		exit(1);
+	}
+	fclose(f);
+	buf[len]='\0';
+	end=buf+len;
+	ptr=buf;
+
+	if(!eat('(')) punt("\"(\" expected");
 
 	/* get (DEV UFD) */
-	eat('('), string(dev,6), string(ufd,6), eat(')');
+	if(!eat('(')) punt("\"(\" expected");
+	string(dev,6), string(ufd,6);
+	if(!eat(')')) punt("\")\" expected");
 
 	/* file entries until ')' */
-	while(!eat(')')) file(d);	/* loop through all files */
-	return(0);			/* success */
+	while(!eat(')')) file();	/* loop through all files */
+
+	free(buf);
 }
 
-/* process next file */
-static void file(char *dirname)
+/* parse next file into ents[] */
+static void file()
 {
-	static char link[50], f1[7], f2[7];
-	char *fname;
- 
-	static char date[LISPLEN];
+	static char link[50];
+	struct entry *e;
 	char *p, *q;
-	int len;
 	long size, byte;
-	time_t date1, date2;
-	struct tm *d;
 
-	if(!eat('(')) punt();
-	if(string(fn1,6)) {
-		if(!string(fn2,6)) punt();
+	if(!eat('(')) punt("\"(\" expected");
+	if(nents>=maxents) {
+		maxents=maxents?maxents*2:256;
+		if((ents=realloc(ents,maxents*sizeof(struct entry)))==NULL)
+			nomem();
+	}
+	e=&ents[nents];
+	memset(e,0,sizeof(struct entry));
+	if(string(e->fn1,6)) {
+		if(!string(e->fn2,6)) punt("FN2 expected");
 		size=number(), byte=number();
 
 		/* file or link but not both */
 		if(string(link,sizeof(link)-1)) {
-			if(size>=0||byte>=0) punt();
+			if(size>=0||byte>=0) punt("link can't have a length");
 		}
 		else {
-			if(size<0||byte<0) punt();
+			if(size<0||byte<0) punt("file must have a length");
 		}
 
-		/* correct the dates */
-		numhuge(date,LISPLEN);	/* creation date */
-		subhuge(date,lispoffset,LISPLEN);  /* convert LISP => WEENIX */
-		date1=valhuge(date,LISPLEN);  /* NOW it should fit in time_t */
-
-		numhuge(date,LISPLEN);	/* again for ref date */
-		subhuge(date,lispoffset,LISPLEN);
-		date2=valhuge(date,LISPLEN);
+		e->cdate=getdate();	/* creation date */
+		e->rdate=getdate();	/* ref date */
 
-		string(author,6);	/* file author's name */
-
-		d=localtime(&date1); /* creation date */
-		memcpy(&cdate,d,sizeof(struct tm));
-
-		d=localtime(&date2); /* ref date */
-		memcpy(&rdate,d,sizeof(struct tm));
+		string(e->author,6);	/* file author's name */
 
 		/* handle link or file */
 		if(size<0) { /* link */
-			p=strchr(link,';');
+			if((p=strchr(link,';'))==NULL||p[1]!=' '||
+				(q=strchr(p+2,' '))==NULL)
+				punt("link must be \"UFD; FN1 FN2\"");
 			*p=0, p+=2;
-			q=strchr(p,' ');
 			*q++=0;
-			len=strlen(link);	/* copy/truncate link UFD */
-			if(len>6) len=6;
-			strncpy(lufd,link,len);
-			lufd[len]='\0';
-			len=strlen(p);		/* FN1 */
-			if(len>6) len=6;
-			strncpy(lfn1,p,len);
-			lfn1[len]='\0';
-			len=strlen(q);		/* FN2 */
-			if(len>6) len=6;
-			strncpy(lfn2,q,len);
-			lfn2[len]='\0';
-			islink=1;
+			/* copy/truncate UFD, FN1, FN2 to 6 chars + NUL */
+			sprintf(e->lufd,"%.6s",link);
+			sprintf(e->lfn1,"%.6s",p);
+			sprintf(e->lfn2,"%.6s",q);
+			e->islink=1;
 		}
-		else islink=0;
-
-		/* copy ITS filename out of the way to WEENIXify it */
-		strcpy(f1,fn1);
-		strcpy(f2,fn2);
-		weenixname(f1);
-		weenixname(f2);
-
-		/* compose filename */
-		fname=malloc(strlen(dirname)+1+strlen(f1)+1+strlen(f2)+1);
-			/* space for path / f1 . f2 <NUL> */
-		if(fname==NULL) nomem();
-		sprintf(fname,"%s/%s.%s",dirname,f1,f2);
-
-		/* now save the file */
-		save(fname);
-		free(fname);
+		nents++;
+	}
+	if(!eat(')')) punt("\")\" expected");
+}
+
+/* save the file for entry E of DIR.LIST in directory DIRNAME */
+static void use(char *dirname,struct entry *e)
+{
+	char f1[7], f2[7];
+	char *fname;
+	time_t t;
+
+	strcpy(fn1,e->fn1);
+	strcpy(fn2,e->fn2);
+	strcpy(author,e->author);
+	strcpy(lufd,e->lufd);
+	strcpy(lfn1,e->lfn1);
+	strcpy(lfn2,e->lfn2);
+	islink=e->islink;
+
+	/* (localtime_r() doesn't check TZ again every time) */
+	memset(&cdate,0,sizeof(struct tm));
+	if(e->cdate!=NODATE) {
+		t=e->cdate;
+		localtime_r(&t,&cdate);
+	}
+	memset(&rdate,0,sizeof(struct tm));
+	if(e->rdate!=NODATE) {
+		t=e->rdate;
+		localtime_r(&t,&rdate);
 	}
-	if(!eat(')')) punt();
+
+	/* copy ITS filename out of the way to WEENIXify it */
+	strcpy(f1,fn1);
+	strcpy(f2,fn2);
+	weenixname(f1);
+	weenixname(f2);
+
+	/* compose filename */
+	fname=malloc(strlen(dirname)+1+strlen(f1)+1+strlen(f2)+1);
+		/* space for path / f1 . f2 <NUL> */
+	if(fname==NULL) nomem();
+	sprintf(fname,"%s/%s.%s",dirname,f1,f2);
+
+	/* now save the file */
+	save(fname,NULL);
+	free(fname);
 }
 
-/* if next char matches C, eat it and return 1, otherwise return 0 */
-static int eat(char c)
+/* skip white space */
+static void skip()
 {
-	char q;
-	while((q=getc(dir))==' ') ;
-	if(q==c) return(1);
-	ungetc(q,dir);
-	return(0);
+	while(*ptr==' '||*ptr=='\t'||*ptr=='\r'||*ptr=='\n') ptr++;
+}
+
+/* skip white space, then if next char matches C, eat it and return 1, */
+/* otherwise return 0 */
+static int eat(int c)
+{
+	skip();
+	if(*ptr!=c) return(0);
+	ptr++;
+	return(1);
+}
+
+/* if next token is NIL, eat it and return 1, otherwise return 0 */
+static int nil()
+{
+	if(!eat('N')) return(0);
+	if(ptr[0]!='I'||ptr[1]!='L') punt("NIL expected");
+	ptr+=2;
+	return(1);
 }
 
 /* parse a string (up to N chars not including NUL) */
 /* returns 1 if string read, or 0 if NIL */
-static int string(char *buf,int n)
+static int string(char *s,int n)
 {
-	char c;
-	if(eat('"')) {	/* quoted string */
-		while((c=getc(dir))!=EOF) switch(c) {
-		case '"':
-			/* end of string */
-			*buf='\0'; 
-			return(1);
-		case '\\':
-			/* only used in \" to quote '"' */
-			if((c=getc(dir))!='"') punt();
-			/* drop through to store it */
-		default:
-			/* anything else goes in buf if there's space */
-			if(n) *buf++=c, n--;
-		}
-	} else {	/* must be NIL */
-		if(eat('N')&&eat('I')&&eat('L')) {
-			*buf='\0';
-			return(0);
+	char *p;
+	int c;
+
+	if(nil()) {
+		*s='\0';
+		return(0);
+	}
+	if(!eat('"')) punt("string expected");
+	for(p=ptr;p<end;) switch(c=*p++) {
+	case '"':
+		/* end of string */
+		*s='\0';
+		ptr=p;
+		return(1);
+	case '\\':
+		/* only used in \" to quote '"' */
+		if(*p!='"') {
+			ptr=p;
+			punt("only \\\" may be quoted");
 		}
+		c=*p++;
+		/* drop through to store it */
+	default:
+		/* anything else goes in S if there's space */
+		if(n) *s++=c, n--;
+	}
+	ptr=p;
+	punt("unterminated string");
+	return(0);			/* (punt() doesn't return) */
+}
+
+/* parse a single precision number ending in "." (NIL => -1) */
+static long number()
+{
+	long n;
+
+	if(nil()) return(-1);
+	skip();
+	if(!(*ptr>='0'&&*ptr<='9')) punt("number expected");
+	for(n=0;*ptr>='0'&&*ptr<='9';ptr++) {
+		n=n*10+(*ptr-'0');
+		if(n>0777777777777L) punt("number too big");
 	}
-	punt();
+	if(!eat('.')) punt("\".\" expected");
+	return(n);
 }
 
-/* parse a single precision number (NIL => -1) */
-static int number()
+/* parse a bignum, maybe ending in "." (NIL => 0) */
+static int64_t bignum()
 {
-	int i[1];
-	char c;
-	while((c=getc(dir))==' ') ;
-	ungetc(c,dir);
-	if(c>='0'&&c<='9') {
-		fscanf(dir,"%d",i);
-		if(!eat('.')) punt();
-		return(i[0]);
-	} else {	/* must be NIL */
-		if(eat('N')&&eat('I')&&eat('L')) return(-1);
-		else punt();
+	int64_t n;
+
+	if(nil()) return(0);
+	skip();
+	if(!(*ptr>='0'&&*ptr<='9')) punt("number expected");
+	for(n=0;*ptr>='0'&&*ptr<='9';ptr++) {
+		if(n>(INT64_MAX-9)/10) punt("number too big");
+		n=n*10+(*ptr-'0');
 	}
+	if(*ptr=='.') ptr++;
+	return(n);
 }
 
-/* parse a huge number into an array of decimal digits (NIL => 0) */
-/* p[0] is LSD, n is # digits */
-static void numhuge(char *p,int n)
+/* parse a Lisp date, return it as a UNIX time (NODATE if NIL) */
+static int64_t getdate()
 {
-	register char c;
-	char *p1;
-	int n1;
+	int64_t lisp;
+	time_t t;
+	struct tm tm;
+
+	if((lisp=bignum())==0) return(NODATE);
+	t=lisp-LISPOFFSET;		/* convert LISP => WEENIX */
+	if(t+LISPOFFSET!=lisp||localtime_r(&t,&tm)==NULL)
+		punt("date out of range");
+	return(t);
+}
 
-	for(p1=p,n1=n;n1--;) *p1++=0;	/* clear it out */
+/* error parsing DIR.LIST, say what's wrong and where */
+static void punt(char *msg)
+{
+	fflush(stdout);
+	fprintf(stderr,"?Format error in %s at byte %ld:  %s\n",
+		listname,(long)(ptr-buf),msg);
+	exit(1);
+}
 
-	while((c=getc(dir))==' ') ;	/* scan off leading spaces */
-	if(c>='0'&&c<='9') {
-		for(;c>='0'&&c<='9';c=getc(dir)) {
-			for(p1=p+n-1,n1=n-1;n1--;p1--) *p1=*(p1-1);
-			p[0]=c-'0';
-		}
-		if(c!='.') ungetc(c,dir);
+/* return the name of the cache file for the DIR.LIST in directory D */
+/* (a hash of its full pathname, so it's the same from anywhere), or */
+/* NULL if there's something funny about D */
+static char *cachename(char *d)
+{
+	char path[PATH_MAX], *p;
+	uint64_t h;
+
+	if(realpath(d,path)==NULL) return(NULL);
+	for(h=UINT64_C(14695981039346656037),p=path;*p;p++)  /* FNV-1a */
+		h=(h^(*p&0377))*UINT64_C(1099511628211);
+	if((p=malloc(strlen(cachedir)+1+16+4+1))==NULL) nomem();
+	sprintf(p,"%s/%016llx.dlc",cachedir,(unsigned long long)h);
+	return(p);
+}
+
+/* load ents[] (and DEV and UFD) from cache file CACHE, if it's there and */
+/* is for DIR.LIST NAME (the file actually found, maybe with .Z or .gz, in */
+/* its current state S), return NZ if so */
+static int loadcache(char *cache,char *name,struct stat *s)
+{
+	char path[PATH_MAX];
+	unsigned char *map, *p;
+	struct stat sc;
+	unsigned long i, n, len;
+	struct entry *e;
+	int fd, j, ok=0;
+
+	if(realpath(name,path)==NULL) return(0);
+	if((fd=open(cache,O_RDONLY))<0) return(0);
+	if(fstat(fd,&sc)<0||sc.st_size<HDRLEN||
+		(map=mmap(NULL,sc.st_size,PROT_READ,MAP_PRIVATE,fd,0))==
+		MAP_FAILED) {
+		close(fd);
+		return(0);
+	}
+	close(fd);
+
+	n=get32(map+24);
+	len=get32(map+28);
+	if(memcmp(map,MAGIC,8)!=0||get64(map+8)!=s->st_size||
+		get64(map+16)!=s->st_mtime||len!=strlen(path)||
+		sc.st_size<HDRLEN+((len+7)&~7)||
+		n>(sc.st_size-HDRLEN-((len+7)&~7))/ENTLEN||
+		sc.st_size!=HDRLEN+((len+7)&~7)+n*ENTLEN||
+		memcmp(map+HDRLEN,path,len)!=0) goto done;
+
+	/* every name must fit in our 7-char buffers, or it's no good */
+	if(!terminated(map+32)||!terminated(map+40)) goto done;
+	p=map+HDRLEN+((len+7)&~7);
+	for(i=0;i<n;i++,p+=ENTLEN)
+		for(j=0;j<48;j+=8)	/* FN1 FN2 AUTHOR LUFD LFN1 LFN2 */
+			if(!terminated(p+j)) goto done;
+
+	memcpy(dev,map+32,7);
+	memcpy(ufd,map+40,7);
+	if(n>maxents) {
+		maxents=n;
+		if((ents=realloc(ents,maxents*sizeof(struct entry)))==NULL)
+			nomem();
 	}
-	else {	/* must be NIL */
-		if(!(eat('N')&&eat('I')&&eat('L')))
-			punt();		/* isn't */
-		/* otherwise keep our giant 0 */
+	p=map+HDRLEN+((len+7)&~7);
+	for(i=0,e=ents;i<n;i++,e++,p+=ENTLEN) {
+		memcpy(e->fn1,p,8);
+		memcpy(e->fn2,p+8,8);
+		memcpy(e->author,p+16,8);
+		memcpy(e->lufd,p+24,8);
+		memcpy(e->lfn1,p+32,8);
+		memcpy(e->lfn2,p+40,8);
+		e->islink=get32(p+48);
+		e->cdate=get64(p+56);
+		e->rdate=get64(p+64);
 	}
+	nents=n;
+	ok=1;
+done:
+	munmap(map,sc.st_size);
+	return(ok);
 }
 
-/* subtract two huge numbers */
-/* a=a-b, n=# digits, a[0]/b[0] is LSD */
-static void subhuge(char *a,char *b,int n)
+/* save ents[] (and DEV and UFD) in cache file CACHE, for DIR.LIST NAME */
+/* (in its current state S) -- just warn if we can't */
+static void savecache(char *cache,char *name,struct stat *s)
 {
-	register int digit, borrow;
-
-	for(borrow=0;n--;a++,b++) {
-		digit=borrow+(int)*a-(int)*b;  /* compute new digit */
-		if(digit<0) {		/* borrowed */
-			*a=(digit+10);	/* fix it */
-			borrow=-1;	/* borrow from next column */
-		}
-		else {
-			*a=digit;	/* no borrow, just save it */
-			borrow=0;
-		}
+	char path[PATH_MAX], *tmp;
+	struct entry *e;
+	unsigned long i, len;
+	FILE *f;
+
+	if(realpath(name,path)==NULL) return;  /* (it was there a moment ago) */
+	len=strlen(path);
+	/* write it under another name, so nobody sees it half written */
+	if((tmp=malloc(strlen(cache)+20))==NULL) nomem();
+	sprintf(tmp,"%s.%ld",cache,(long)getpid());
+	if((f=fopen(tmp,"wb"))==NULL) goto fail;
+	fwrite(MAGIC,1,8,f);
+	put64(f,s->st_size);
+	put64(f,s->st_mtime);
+	put32(f,nents);
+	put32(f,len);
+	fwrite(dev,1,7,f);		/* (both NUL padded to 8) */
+	putc(0,f);
+	fwrite(ufd,1,7,f);
+	putc(0,f);
+	fwrite(path,1,len,f);
+	for(;len&7;len++) putc(0,f);
+	for(i=0,e=ents;i<nents;i++,e++) {
+		fwrite(e->fn1,1,8,f);
+		fwrite(e->fn2,1,8,f);
+		fwrite(e->author,1,8,f);
+		fwrite(e->lufd,1,8,f);
+		fwrite(e->lfn1,1,8,f);
+		fwrite(e->lfn2,1,8,f);
+		put32(f,e->islink);
+		put32(f,0);
+		put64(f,e->cdate);
+		put64(f,e->rdate);
+	}
+	if(fclose(f)==EOF||rename(tmp,cache)<0) {
+		unlink(tmp);
+		goto fail;
 	}
+	free(tmp);
+	return;
+fail:
+	fprintf(stderr,"WARNING: Can't write DIR.LIST cache %s\n",cache);
+	free(tmp);
 }
 
-/* convert huge to time_t */
-static time_t valhuge(char *p,int n)
+/* return NZ if the 8-byte name field at P has a NUL in its first 7 bytes */
+static int terminated(unsigned char *p)
 {
-	register time_t val=0;
-	for(p+=n;n--;) val=val*10L+(time_t)*--p;
-	return(val);
+	return(memchr(p,0,7)!=NULL);
 }
 
-/* error parsing DIR.LIST */
-static void punt()
+/* write a longword, LSB first */
+static void put32(FILE *f,unsigned long n)
 {
-	int c, i;
-	fflush(stdout);
-	fprintf(stderr,"DIR.LIST format error -- exiting\n");
-	for(i=100;i&&(c=getc(dir))>=0;i--) putc(c,stderr);
-	putc('\n',stderr);
-	exit(1);
+	int i;
+	for(i=0;i<4;i++,n>>=8) putc(n&0377,f);
+}
+
+/* write a quadword, LSB first */
+static void put64(FILE *f,uint64_t n)
+{
+	int i;
+	for(i=0;i<8;i++,n>>=8) putc(n&0377,f);
+}
+
+/* read a longword, LSB first */
+static unsigned long get32(unsigned char *p)
+{
+	return(((unsigned long)p[3]<<24)|((unsigned long)p[2]<<16)|
+		((unsigned long)p[1]<<8)|p[0]);
+}
+
+/* read a quadword, LSB first */
+static uint64_t get64(unsigned char *p)
+{
+	return(((uint64_t)get32(p+4)<<32)|get32(p));
 }
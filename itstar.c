@@ -41,12 +41,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include <fcntl.h>
+#include <stdint.h>
 #include <time.h>
 #include <unistd.h>
 #include <utime.h>
 #include <ctype.h>
 
 #include "itstar.h"
+#include "tapidx.h"
 
 /* variables for estimating length of tape used: */
 extern unsigned long bpi;	/* tape density in bits per inch */
@@ -55,20 +57,29 @@ extern int simh;		/* NZ to support SIMH tape images */
 int seven_track = 0;		/* NZ to write 7-track tape images */
 int big_endian = 0;		/* NZ to read big endian record length */
 int old_header = 0;		/* NZ to limit file header to six words */
+int checkparity = 0;		/* NZ to check 7-track parity on read */
+int blocking = 1;		/* records are this many times 1024 words */
+int jobs = 1;			/* # threads converting files */
+extern unsigned long parerrs;	/* # records with bad parity */
 
 static void usage(int), itsname(char *), extitsname(char *, char *, char *, char *), changedir();
 static void addfiles(int, char **), addfile(int, char **, char *), listfiles(int, char **), listfile(),
-	extfiles(int, char **), extfile();
+	showfile(), idxlist(), extfiles(int, char **), extfile(), indexfiles(),
+	readfile(uint64_t **, unsigned long *),
+	directory(), notefile(), idxscan(void (*)());
+static int wanted(unsigned long, uint64_t *);
+static void volume(uint64_t *, int), label(uint64_t *, int), unsix(uint64_t, char *);
 static void scantape(int argc,char **argv,void (*process)());
-void save(char *), weenixname(char *), nomem();
+void weenixname(char *), nomem();
 void writevolhdr(void);
-void outsix(char *s);
+uint64_t sixbit(char *s);
 void insix(char *s);
 
 int append=0;	/* func=append */
 int create=0;	/* func=create */
 int type=0;	/* func=type filenames */
 int extract=0;	/* func=extract files */
+int mkindex=0;	/* func=build record index */
 int verify=0;	/* NZ => print names of all files processed on stdout */
 
 unsigned long tapeno=1, reelno=0;  /* DUMP tape, reel number */
@@ -82,11 +93,21 @@ char lufd[7], lfn1[7], lfn2[7];  /* same as above, for target of link */
 char dev[7], author[7];	 /* not currently used, but available in DIR.LIST */
 struct tm cdate, rdate;  /* creation, ref dates (none if tm_year=0) */
 static int tape_year, tape_month, tape_day;
+static uint64_t lname[3];  /* UFD, FN1, FN2 from label as SIXBIT */
+
+static char *want=NULL;	/* per-file selection, if that depends on whole tape */
+static unsigned long nwant;  /* # entries in want[] */
+static uint64_t (*names)[3];  /* UFD, FN1, FN2 of all files, to set want[] */
+static unsigned long nnames, maxnames;
+static int prescan=0;	/* NZ => reading labels to set up want[] */
 
 static char sbuf[256];	/* scratch buffer, for readlink() */
 
 static char *dir=NULL;	/* directory to change to */
 static char *tape=NULL;  /* name of tape drive or file */
+static char *list=NULL;	/* manifest of files to save, for -T */
+static char *archive=NULL;  /* tar/cpio archive of files to save, for -I */
+static char *xarchive=NULL;  /* tar/cpio archive to extract into, for -X */
 
 int main(int argc,char **argv)
 {
@@ -103,6 +124,13 @@ int main(int argc,char **argv)
 			if(*p=='-') p++;  /* skip the '-' if it's there */
 			while(*p) {	/* scan next byte of option */
 				switch(*p++) {
+				case 'b':	/* blocking factor */
+					if(!*p) {	/* -b n */
+						if((--argc)==0) goto msgarg;
+						p=*++argv;
+					}
+					blocking=atoi(p);  /* -bn */
+					goto nxtwrd;
 				case 'c':	/* create archive */
 					create=1;
 					break;
@@ -120,11 +148,52 @@ int main(int argc,char **argv)
 						tape=*++argv;
 					}
 					goto nxtwrd;
+				case 'F':	/* output format for -x */
+					if(!*p) {	/* -F fmt */
+						if((--argc)==0) goto msgarg;
+						p=*++argv;
+					}
+					packformat(p);	/* -Ffmt */
+					goto nxtwrd;
 				case 'h':	/* help */
 					usage(0);
+				case 'i':	/* build index */
+					mkindex=1;
+					break;
+				case 'I':	/* tar/cpio archive to save */
+					if(*p) archive=p;  /* -Ifile */
+					else {	/* -I file */
+						if((--argc)==0) goto msgarg;
+						archive=*++argv;
+					}
+					goto nxtwrd;
+				case 'j':	/* # threads converting files */
+					if(!*p) {	/* -j n */
+						if((--argc)==0) goto msgarg;
+						p=*++argv;
+					}
+					jobs=atoi(p);  /* -jn */
+					goto nxtwrd;
+				case 'k':	/* DIR.LIST cache directory */
+					if(!*p) {	/* -k dir */
+						if((--argc)==0) goto msgarg;
+						p=*++argv;
+					}
+					dircache(p);	/* -kdir */
+					goto nxtwrd;
+				case 'p':	/* check 7-track parity */
+					checkparity=1;
+					break;
 				case 'r':	/* append to archive */
 					append=1;
 					break;
+				case 'T':	/* manifest of files to save */
+					if(*p) list=p;  /* -Tfile */
+					else {	/* -T file */
+						if((--argc)==0) goto msgarg;
+						list=*++argv;
+					}
+					goto nxtwrd;
 				case 't':	/* type filenames */
 					type=1;
 					break;
@@ -134,6 +203,13 @@ int main(int argc,char **argv)
 				case 'x':	/* extract files */
 					extract=1;
 					break;
+				case 'X':	/* extract to tar/cpio archive */
+					if(*p) xarchive=p;  /* -Xfile */
+					else {	/* -X file */
+						if((--argc)==0) goto msgarg;
+						xarchive=*++argv;
+					}
+					goto nxtwrd;
 				case '7':	/* 7-track tape images */
 					seven_track=1;
 					break;
@@ -158,16 +234,40 @@ int main(int argc,char **argv)
 	}
 
 	/* check switches */
-	if((append+create+type+extract)==0) {
-		fprintf(stderr,"?Must specify one of:  -c -t -r -x\n");
+	if((append+create+type+extract+mkindex)==0) {
+		fprintf(stderr,"?Must specify one of:  -c -t -r -x -i\n");
 		exit(1);
 	}
 
-	if((append+create+type+extract)>1) {
+	if((append+create+type+extract+mkindex)>1) {
 		fprintf(stderr,"?Switch conflict\n");
 		exit(1);
 	}
 
+	if(list) {
+		if(!append&&!create) {
+			fprintf(stderr,"?-T only works with -c or -r\n");
+			exit(1);
+		}
+		manifest(list);	/* open it before -C */
+	}
+	if(archive) {
+		if(!append&&!create) {
+			fprintf(stderr,"?-I only works with -c or -r\n");
+			exit(1);
+		}
+		tarin(archive);	/* open it before -C */
+	}
+	if(xarchive) {
+		if(!extract) {
+			fprintf(stderr,"?-X only works with -x\n");
+			exit(1);
+		}
+		tarout(xarchive);  /* open it before -C */
+	}
+
+	if(jobs<=0) jobs=sysconf(_SC_NPROCESSORS_ONLN);  /* -j 0 => 1/CPU */
+
 	/* get local time for tape creation info */
 	t0=time((time_t *)0);		/* secs since midnight 01-Jan-1970 */
 	now=localtime(&t0);		/* unpack into local time */
@@ -175,7 +275,7 @@ int main(int argc,char **argv)
 		now->tm_year%100,now->tm_mon+1,now->tm_mday);
 
 	setenv("TZ","EST5EDT",1);	/* ITS dates are all Cambridge, MA */
-/*	tzset(); */
+	tzset();			/* (localtime_r() doesn't check TZ itself) */
 
 	if(append) {			/* append to existing tape */
 		opentape(tape,0,1);	/* open tape */
@@ -192,20 +292,29 @@ int main(int argc,char **argv)
 		addfiles(argc,argv);	/* add files onto end */
 	}
 	else if(type) {			/* list files on tape */
-		if(argc!=0) usage(1);	/* should we handle filenames?  no. */
 		opentape(tape,0,0);	/* open tape */
 		changedir();		/* change directory */
 		posnbot();		/* rewind */
 		listfiles(argc,argv);	/* list files */
 	}
+	else if(mkindex) {		/* index an image file */
+		if(argc!=0) usage(1);
+		opentape(tape,0,0);	/* open tape */
+		posnbot();		/* rewind */
+		indexfiles();		/* read through whole tape */
+	}
 	else /*if(extract)*/ {		/* extract files from tape */
-		if(argc!=0) usage(1);	/* should we handle filenames?  soon */
 		opentape(tape,0,0);	/* open tape */
 		changedir();		/* change directory */
 		posnbot();		/* rewind */
 		extfiles(argc,argv);	/* extract files */
 	}
 	closetape();
+	if(parerrs) {
+		fprintf(stderr,"?%lu record%s with bad parity\n",parerrs,
+			parerrs==1?"":"s");
+		exit(1);
+	}
 	exit(0);
 }
 
@@ -222,12 +331,16 @@ static void changedir(void)
 /* write DUMP volume header to tape */
 void writevolhdr(void)
 {
+	uint64_t w[4];
+
 	resetbuf();		/* a record all to itself */
-	outword(-4L,0L);	/* 1: AOBJN pointer giving length */
-	outword(tapeno,reelno);	/* 2: tape,,reel */
+	w[0]=(uint64_t)(01000000L-4)<<18;  /* 1: AOBJN pointer giving length */
+	w[1]=((uint64_t)(tapeno&0777777)<<18)|(reelno&0777777);
+				/* 2: tape,,reel */
 	if(verify) printf("Tape %ld, reel %ld\n",tapeno,reelno);
-	outsix(date6);		/* 3: today's date */
-	outword(0L,0L);		/* 4: random dump (not full/incremental) */
+	w[2]=sixbit(date6);	/* 3: today's date */
+	w[3]=0;			/* 4: random dump (not full/incremental) */
+	outwords(w,4);
 /*	tapeflush();	*/	/* write it out */
 	/* N.B. no tape mark between vol. header and first file label */
 }
@@ -239,9 +352,13 @@ static void addfiles(int argc,char **argv)
 	int c=argc;
 	char **v=argv;
 
+	if(jobs>1) startpool(jobs,1);  /* files are unpacked by pool.c */
 	while(c--) {
 		addfile(argc,argv,*v++);
 	}
+	addmanifest();		/* then any listed by -T */
+	addarchive();		/* then any in -I archive */
+	endpool();		/* wait for them to be written */
 	if(verify)
 		printf("Approximately %lu.%lu' of tape used\n",count/bpi/12,
 			(count*10/bpi/12)%10);
@@ -259,47 +376,23 @@ static void addfile(int argc,char **argv,char *f)
 		exit(1);
 	}
 
-	/* if it's a bare directory, recurse for all files in that dir */
-	if(S_ISDIR(s.st_mode)) {  /* is it a directory? */
-		DIR *dir;
-		struct dirent *d;
-		char *p;
-
-		/* if the dir contains DIR.LIST, use that to find files */
-		if(dirlist(argc,argv,f)==0) return;
-
-		/* otherwise open the directory */
-		if((dir=opendir(f))==NULL) {
-			fprintf(stderr,"?Error opening directory %s\n",f);
-			exit(1);
-		}
-
-		/* read through dir entries */
-		while((d=readdir(dir))!=NULL) {
-			if(d->d_name[0]=='.')	/* ignore ./.., hidden files */
-				continue;
-			/* alloc space for path+'/'+file+NUL */
-			if((p=malloc(strlen(f)+1+strlen(d->d_name)+1))==NULL)
-				nomem();
-			/* combine path, /, filename, NUL */
-			strcpy(p,f);
-			strcat(p,"/");
-			strcat(p,d->d_name);
-			/* recurse */
-			addfile(argc,argv,p);
-			free(p);
-		}
-		closedir(dir);
-		return;
-	}
+	/* if it's a bare directory, walk.c does all files under it */
+	/* (using DIR.LIST where there is one) */
+	if(S_ISDIR(s.st_mode)) walk(argc,argv,f);
+	else addentry(f,&s);
+}
 
+/* add file F (not a directory), whose lstat() info is in S */
+/* output buffer must have been initialized with resetbuf() */
+void addentry(char *f,struct stat *s)
+{
 	/* extract dir name/filename, convert to UFD/FN1/FN2 */
 	extitsname(f,ufd,fn1,fn2);
 
-	memcpy(&cdate,localtime(&s.st_mtime),sizeof(struct tm));
-	memcpy(&rdate,localtime(&s.st_atime),sizeof(struct tm));
+	localtime_r(&s->st_mtime,&cdate);
+	localtime_r(&s->st_atime,&rdate);
 
-	if(S_ISLNK(s.st_mode)) {  /* it's a link */
+	if(S_ISLNK(s->st_mode)) {  /* it's a link */
 		int len=readlink(f,sbuf,sizeof(sbuf)-1);  /* get link name */
 				/* (-1 to allow for adding NUL) */
 		if(len<0) {
@@ -313,52 +406,84 @@ static void addfile(int argc,char **argv,char *f)
 	else islink=0;
 
 	/* now that we've gotten all the names and dates, actually save it */
-	save(f);
+	save(f,NULL);
+}
+
+/* add member F of a tar or cpio archive, with modification and access */
+/* times MTIME and ATIME, which is a link to LINK if that's not NULL, or */
+/* else a file whose contents can be read from IN */
+/* output buffer must have been initialized with resetbuf() */
+void addmember(char *f,time_t mtime,time_t atime,char *link,FILE *in)
+{
+	/* same as addentry() but everything's already in hand */
+	extitsname(f,ufd,fn1,fn2);
+
+	localtime_r(&mtime,&cdate);
+	localtime_r(&atime,&rdate);
+
+	if(link) {
+		extitsname(link,lufd,lfn1,lfn2);
+		islink=1;
+	}
+	else islink=0;
+
+	save(f,in);
 }
 
 /* save a file based using information in UFD/FN1/FN2/CDATE etc. */
+/* its contents are read from IN if that's not NULL, or else from file F */
 /* output buffer must have been initialized with resetbuf() */
-void save(char *f)
+void save(char *f,FILE *in)
 {
 	long len = 7;
+	uint64_t w[7+3];
+
 	if(verify) printf("%s => %s;%s %s ",f,ufd,fn1,fn2);
 
 	if (old_header)
 		len = 6;
-	outword(-len,0L);	/* 1: AOBJN ptr giving length */
-	outsix(ufd);		/* 2: UFD */
-	outsix(fn1);		/* 3: filename 1 */
-	outsix(fn2);		/* 4: filename 2 */
-	outword(islink,0L);	/* 5: linkf,,pack */
-	outword((((unsigned long)cdate.tm_year)<<9L)|
+	w[0]=(uint64_t)(01000000L-len)<<18;  /* 1: AOBJN ptr giving length */
+	w[1]=sixbit(ufd);	/* 2: UFD */
+	w[2]=sixbit(fn1);	/* 3: filename 1 */
+	w[3]=sixbit(fn2);	/* 4: filename 2 */
+	w[4]=(uint64_t)islink<<18;  /* 5: linkf,,pack */
+	w[5]=((uint64_t)((((unsigned long)cdate.tm_year)<<9L)|
 		(((unsigned long)cdate.tm_mon+1L)<<5L)|
-		(unsigned long)cdate.tm_mday,
-		((((unsigned long)cdate.tm_hour*60L)+
+		(unsigned long)cdate.tm_mday)<<18)|
+		(((((unsigned long)cdate.tm_hour*60L)+
 		(unsigned long)cdate.tm_min)*60L+
 		(unsigned long)cdate.tm_sec)*2L);  /* 6: date of creation */
 	/* note:  year field is officially only 7 bits, but the 2 bits to */
 	/* left of it are unused in UFD entries so hopefully it's safe to */
 	/* grab them */
 	/* tm_year and UFD year field are both YEAR-1900 */
-	if (len >= 7) {
-		outword((((unsigned long)cdate.tm_year)<<9L)|
-			(((unsigned long)cdate.tm_mon+1L)<<5L)|
-			(unsigned long)cdate.tm_mday,
-			((((unsigned long)cdate.tm_hour*60L)+
-			(unsigned long)cdate.tm_min)*60L+
-			(unsigned long)cdate.tm_sec)*2L);
-		/* 7: date of last ref */
+	w[6]=w[5];		/* 7: date of last ref */
+
+	if(jobs>1) {		/* let pool.c unpack it and write it */
+		if(islink) {	/* link target follows label */
+			w[len]=sixbit(lfn1);
+			w[len+1]=sixbit(lfn2);
+			w[len+2]=sixbit(lufd);
+			savejob(w,len+3,NULL,f);
+		}
+		else savejob(w,len,in?in:unpackopen(f),f);
+		if(verify) printf("[OK]\n");
+		return;
 	}
+
+	outwords(w,len);
 /*	tapeflush();	*/	/* finish off label record */
 
 	if(islink) {		/* it's a link, not a file */
-		outsix(lfn1);	/* write it out (note funny order) */
-		outsix(lfn2);
-		outsix(lufd);
+		w[0]=sixbit(lfn1);  /* write it out (note funny order) */
+		w[1]=sixbit(lfn2);
+		w[2]=sixbit(lufd);
+		outwords(w,3);
 		tapeflush();	/* end of record (just 15 bytes) */
 	}
 	else {
-		unpack(f);	/* add the file itself */
+		if(in) unpackstream(in,f);  /* add the file itself */
+		else unpack(f);
 		tapeflush();	/* finish off final record */
 	}
 	tapemark();		/* write EOF */
@@ -369,20 +494,52 @@ void save(char *f)
 /* list files on tape */
 static void listfiles(int argc,char **argv)
 {
-	scantape(argc,argv,listfile);
+	patterns(argc,argv);	/* which files to list */
+	if(versions()) directory();
+	if(idxvalid&&!checkparity)  /* index has all we need */
+		idxlist();		/* (but -p has to see every frame) */
+	else scantape(argc,argv,listfile);
+}
+
+/* list files using the record index instead of reading the tape */
+static void idxlist()
+{
+	struct idxfile *f;
+	unsigned long i;
+
+	volume(idxvol,idxvollen);
+	for(i=0,f=idxfiles;i<nidxfiles;i++,f++) {
+		label(f->label,f->lablen);
+		if(!wanted(i,f->label)) continue;
+		if(islink) {
+			unsix(f->link[0],lfn1);
+			unsix(f->link[1],lfn2);
+			unsix(f->link[2],lufd);
+		}
+		showfile();
+	}
 }
 
 /* list a single file (called back by scantape()) */
 static void listfile()
+{
+	if(verify&&islink) {		/* get link target */
+		insix(lfn1);
+		insix(lfn2);
+		insix(lufd);
+	}
+	showfile();
+	tapeskip();			/* skip until tape mark */
+}
+
+/* print name (and more if -v) of a file whose label has been read */
+static void showfile()
 {
 	static const char spaces[] = "                    ";
 	int n;
 	n=printf("%s;%s %s",ufd,fn1,fn2);  /* print ITS filename */
 	if (verify) {
 	  if(islink) {
-	    insix(lfn1);
-	    insix(lfn2);
-	    insix(lufd);
 	    printf ("   %s;%s %s", lufd, lfn1, lfn2);
 	  } else if (cdate.tm_year!=0) {
 	      fputs (spaces + n, stdout);
@@ -391,13 +548,105 @@ static void listfile()
 	  }
 	}
 	putchar('\n');
-	while(taperead()==0) ;		/* skip until tape mark */
+}
+
+/* build record index by reading through the whole tape */
+static void indexfiles()
+{
+	int marks;
+
+	idxstart();			/* start new index at BOT */
+	for(marks=0;marks<2;)		/* until two tape marks in a row */
+		if(taperead()<0) marks++;
+		else marks=0;
 }
 
 /* extract files from tape */
 static void extfiles(int argc,char **argv)
 {
-	scantape(argc,argv,extfile);
+	patterns(argc,argv);	/* which files to extract */
+	if(versions()) directory();
+	if(jobs>1&&!xarchive) startpool(jobs,0);  /* files are written */
+					/* by pool.c */
+	if(idxvalid&&!checkparity)  /* go straight to each file */
+		idxscan(extfile);
+	else scantape(argc,argv,extfile);
+	endpool();		/* wait for files to finish */
+	tarend();		/* finish off -X archive */
+}
+
+/* decide which files are wanted, when that depends on what else is on the */
+/* tape (patterns with ">" or "<"), by looking at all of the labels first */
+static void directory()
+{
+	unsigned long i;
+	int c;
+
+	nnames=0;
+	if(idxvalid) {			/* index has all the labels */
+		maxnames=nidxfiles;
+		if((names=malloc((maxnames?maxnames:1)*sizeof(*names)))==NULL)
+			nomem();
+		for(i=0;i<nidxfiles;i++,nnames++) {
+			names[i][0]=idxfiles[i].label[1];
+			names[i][1]=idxfiles[i].label[2];
+			names[i][2]=idxfiles[i].label[3];
+		}
+	}
+	else {				/* read them off the tape */
+		prescan=1;
+		c=checkparity;		/* (the real pass checks parity) */
+		checkparity=0;
+		scantape(0,NULL,notefile);
+		checkparity=c;
+		prescan=0;
+		posnbot();		/* now start over */
+	}
+	nwant=nnames;
+	if((want=malloc(nwant?nwant:1))==NULL) nomem();
+	pickversions(names,nnames,want);
+	free(names);
+}
+
+/* note a file's name for directory() (called back by scantape()) */
+static void notefile()
+{
+	if(nnames==maxnames) {
+		maxnames=maxnames?maxnames*2:1024;
+		if((names=realloc(names,maxnames*sizeof(*names)))==NULL)
+			nomem();
+	}
+	memcpy(names[nnames++],lname,sizeof(lname));
+	tapeskip();			/* don't need the data */
+}
+
+/* return NZ if file number N on tape, with label words W[], is wanted */
+static int wanted(unsigned long n,uint64_t *w)
+{
+	if(prescan) return(1);		/* need to see everything */
+	if(want) return(n<nwant&&want[n]);
+	return(matchname(w));
+}
+
+/* process wanted files, using the record index to go straight to each one */
+static void idxscan(void (*process)())
+{
+	struct idxfile *f;
+	unsigned long i;
+
+	volume(idxvol,idxvollen);
+	for(i=0,f=idxfiles;i<nidxfiles;i++,f++) {
+		label(f->label,f->lablen);
+		if(!wanted(i,f->label)) continue;
+		tapeseek(idxrecs[f->rec].pos);	/* go to label record */
+		if(taperead()<0) {
+			fprintf(stderr,"?Index doesn't match tape\n");
+			exit(1);
+		}
+		/* skip label (and vol header if first file) */
+		skipwords(f->off+(01000000L-(f->label[0]>>18)));
+		(*process)();		/* process the file */
+	}
 }
 
 /* extract a single file (called back by scantape()) */
@@ -409,6 +658,11 @@ static void extfile()
 	static char lname[6+1+6+1+6+1]; /* same, for link name */
 	struct stat s;
 	struct utimbuf u;
+	uint64_t *words;
+	unsigned long n;
+	char *buf;
+	size_t len;
+	int fd;
 
 	if(verify) printf("%s;%s %s ",ufd,fn1,fn2);  /* print ITS filename */
 	weenixname(ufd);	/* convert to WEENIX equivalent */
@@ -418,7 +672,8 @@ static void extfile()
 	if(verify) printf("=> %s ",fname);  /* print WEENIX filename */
 
 	/* create directory if it doesn't exist */
-	if(stat(ufd,&s)<0&&errno==ENOENT) {
+	if(xarchive) tardir(ufd);	/* (in the archive) */
+	else if(stat(ufd,&s)<0&&errno==ENOENT) {
 		if(mkdir(ufd,0755)<0) {
 			fflush(stdout);
 			perror(ufd);
@@ -428,7 +683,7 @@ static void extfile()
 
 	/* renames if file already exists */
 	strcpy(newname, fname);
-	while(lstat(newname,&s)==0) {
+	while(xarchive?tarused(newname):lstat(newname,&s)==0) {
 		sprintf(newname, "%s|%d", fname, counter++);
 	}
 	if(strcmp(fname, newname)) {
@@ -450,7 +705,8 @@ static void extfile()
 		weenixname(lfn1);
 		weenixname(lfn2);
 		sprintf(lname,"%s/%s.%s",lufd,lfn1,lfn2);  /* combine */
-		if(symlink(lname,fname)<0) {  /* create link */
+		if(xarchive) tarlink(fname,lname);
+		else if(symlink(lname,fname)<0) {  /* create link */
 			perror(fname);
 			exit(1);
 		}
@@ -458,15 +714,35 @@ static void extfile()
 		taperead();		/* read the EOF mark */
 	}
 	else {				/* regular file */
-		pack(fname);		/* pack tape file into disk file */
-
-		/* apply file dates from tape */
+		/* file dates from tape */
 		if(cdate.tm_year!=0) {		/* creation date (if known) */
 			u.modtime=mktime(&cdate);  /* convert to time_t */
 			if(rdate.tm_year!=0)	/* ref date (if known) */
 				u.actime=mktime(&rdate);
 			else u.actime=u.modtime;  /* use creation date if not */
-			if(utime(fname,&u)<0) {
+		}
+
+		if(xarchive) {		/* pack it, add it to archive */
+			readfile(&words,&n);
+			packmem(fname,words,n,&buf,&len);
+			tarfile(fname,buf,len,cdate.tm_year?u.modtime:0);
+			free(buf);
+			free(words);
+		}
+		else if(jobs>1) {	/* create it, let pool.c write it */
+			fd=open(fname,O_WRONLY|O_CREAT|O_TRUNC,0666);
+			if(fd<0) {
+				perror(fname);
+				exit(1);
+			}
+			readfile(&words,&n);
+			extjob(fd,fname,words,n,cdate.tm_year?&u:NULL);
+		}
+		else {
+			pack(fname);	/* pack tape file into disk file */
+
+			/* apply file dates */
+			if(cdate.tm_year!=0&&utime(fname,&u)<0) {
 				perror("?Error setting file dates");
 				exit(1);
 			}
@@ -476,6 +752,28 @@ static void extfile()
 	if(verify) printf("[OK]\n");
 }
 
+/* read the rest of the current file into *WORDS (malloc()ed), set *N */
+/* to its length in words */
+static void readfile(uint64_t **words,unsigned long *n)
+{
+	unsigned long max=1024;
+	int k;
+
+	if((*words=malloc(max*sizeof(uint64_t)))==NULL) nomem();
+	*n=0;
+	if((remaining()==0)&&(taperead()<0)) return;  /* null file */
+	for(;;) {
+		if(*n==max) {
+			max*=2;
+			if((*words=realloc(*words,max*sizeof(uint64_t)))==NULL)
+				nomem();
+		}
+		if((k=nextwords(*words+*n,max-*n<0100000?max-*n:0100000))<=0)
+			break;
+		*n+=k;
+	}
+}
+
 static void datime(unsigned long l, unsigned long r)
 {
 	int y, m, d;
@@ -521,79 +819,99 @@ static void datime(unsigned long l, unsigned long r)
 /* scan the tape and process each file found (after setting up globals) */
 static void scantape(int argc,char **argv,void (*process)())
 {
-	unsigned long l,r,len;
+	unsigned long len,i,n=0;
+	uint64_t w[7];
 
 	if(taperead()<0) {	/* read volume header */
 		fprintf(stderr,"?Null tape\n");
 		exit(1);
 	}
 
-		/* display volume header info */
-	inword(&l,&r);	/* 1: AOBJN ptr giving length */
-	len=01000000L-l; /* length of record */
-	if(len>=4) {
-		inword(&l,&r);	/* 2: tape,,real */
-		if(type)
-			printf("Tape %ld, reel %ld",l,r);
-		insix(ufd);	/* 3: SIXBIT creation date */
-		inword(&l,&r);	/* 4: type */
-				/* 0=random, >0=full, <0=incremental */
-		/* Remember tape creation date for 1-bit year conversion. */
-		tape_year = 10*(ufd[0]-'0') + ufd[1]-'0';
-		tape_month = 10*(ufd[2]-'0') + ufd[3]-'0';
-		tape_day = 10*(ufd[4]-'0') + ufd[5]-'0';
-		if(type)
-			printf(", created %c%c/%c%c/%c%c, type=%s\n",
-				ufd[2],ufd[3], ufd[4],ufd[5], ufd[0],ufd[1],
-				(l|r)==0?"random":
-					((l&0400000)?"incremental":"full"));
-		len-=4;		/* eat those words */
-	}
-	while(len--) inword(&l,&r);  /* eat unknown words */
+	/* display volume header info */
+	inwords(w,1);
+	len=01000000L-(w[0]>>18);  /* 1: AOBJN ptr giving length */
+	i=(len<4)?len:4;
+	if(i>1) inwords(w+1,i-1);
+	volume(w,len);
+	if(len>i) skipwords(len-i);  /* eat unknown words */
 	if(remaining()!=0)	/* file header in same rec */
 		goto fhead;
 
 	while(taperead()==0) {	/* read file label */
-	fhead:	inword(&l,&r);	/* 1: AOBJN ptr giving length */
-		len=01000000L-l; /* length of record */
-		if(len<4) {	/* must have at least filename */
-			fprintf(stderr,"?Invalid tape format\n");
-			exit(1);
+	fhead:	inwords(w,1);
+		len=01000000L-(w[0]>>18);  /* 1: AOBJN ptr giving length */
+		if(len<4) i=1;		/* label() will complain */
+		else {
+			i=(len<7)?len:7;
+			inwords(w+1,i-1);
 		}
-		insix(ufd);	/* 2: UFD */
-		insix(fn1);	/* 3: FN1 */
-		insix(fn2);	/* 4: FN2 */
-		len-=4;		/* count those words */
-		if(len) {	/* 5: linkf,,pack */
-			inword(&islink,&r);
-			len--;
-		}
-		else islink=0;	/* (assume file if missing) */
+		label(w,len);
+		if(len>i) skipwords(len-i);  /* eat unknown words */
 
-		if(len) {	/* 6: creation date */
-			inword(&l,&r);
-			datime(l,r);
-			len--;
-		}
-		else cdate.tm_year=0;
-
-		if(len) {	/* 7: reference date */
-			inword(&l,&r);
-			rdate.tm_year=(l>>9L);
-			rdate.tm_mon=((l>>5L)&017)-1;
-			rdate.tm_mday=l&037;
-			rdate.tm_hour=r/(60L*60L*2L);
-			rdate.tm_min=(r/(60L*2L))%60L;
-			rdate.tm_sec=(r/2L)%60L;
-			rdate.tm_isdst=(-1);
-			len--;
+		if(!wanted(n++,w)) {	/* not interested */
+			tapeskip();	/* skip to next file */
+			continue;
 		}
-		else rdate.tm_year=0;
+		(*process)();	/* process the file */
+	}
+}
 
-		while(len--) inword(&l,&r);	/* eat unknown words */
+/* process the volume header, whose first N words are in W[] */
+static void volume(uint64_t *w,int n)
+{
+	unsigned long l,r;
+
+	if(n<4) return;		/* nothing we know about */
+	l=w[1]>>18, r=w[1]&0777777;  /* 2: tape,,reel */
+	if(type&&!prescan)
+		printf("Tape %ld, reel %ld",l,r);
+	unsix(w[2],ufd);	/* 3: SIXBIT creation date */
+	l=w[3]>>18, r=w[3]&0777777;  /* 4: type */
+				/* 0=random, >0=full, <0=incremental */
+	/* Remember tape creation date for 1-bit year conversion. */
+	tape_year = 10*(ufd[0]-'0') + ufd[1]-'0';
+	tape_month = 10*(ufd[2]-'0') + ufd[3]-'0';
+	tape_day = 10*(ufd[4]-'0') + ufd[5]-'0';
+	if(type&&!prescan)
+		printf(", created %c%c/%c%c/%c%c, type=%s\n",
+			ufd[2],ufd[3], ufd[4],ufd[5], ufd[0],ufd[1],
+			(l|r)==0?"random":
+				((l&0400000)?"incremental":"full"));
+}
 
-		(*process)();	/* process the file */
+/* set up UFD, FN1, FN2 etc. from file label, whose first N words are in W[] */
+static void label(uint64_t *w,int n)
+{
+	unsigned long l,r;
+
+	if(n<4) {		/* must have at least filename */
+		fprintf(stderr,"?Invalid tape format\n");
+		exit(1);
+	}
+	unsix(w[1],ufd);	/* 2: UFD */
+	unsix(w[2],fn1);	/* 3: FN1 */
+	unsix(w[3],fn2);	/* 4: FN2 */
+	memcpy(lname,w+1,sizeof(lname));
+
+	if(n>4)			/* 5: linkf,,pack */
+		islink=w[4]>>18;
+	else islink=0;		/* (assume file if missing) */
+
+	if(n>5)			/* 6: creation date */
+		datime(w[5]>>18,w[5]&0777777);
+	else cdate.tm_year=0;
+
+	if(n>6) {		/* 7: reference date */
+		l=w[6]>>18, r=w[6]&0777777;
+		rdate.tm_year=(l>>9L);
+		rdate.tm_mon=((l>>5L)&017)-1;
+		rdate.tm_mday=l&037;
+		rdate.tm_hour=r/(60L*60L*2L);
+		rdate.tm_min=(r/(60L*2L))%60L;
+		rdate.tm_sec=(r/2L)%60L;
+		rdate.tm_isdst=(-1);
 	}
+	else rdate.tm_year=0;
 }
 
 static void usage(int rc)
@@ -608,19 +926,30 @@ This is free software: you are free to change and redistribute it.\n\
 There is NO WARRANTY, to the extent permitted by law.\n\
 \n\
 Usage:  itstar switches file1 file2 file3 ...\n\
+        itstar -t|-x switches [pattern1 pattern2 ...]\n\
 \n\
 switches:\n\
+  -b N          write N*1024-word records (image files for emulators)\n\
   -c            create tape\n\
   -C DIR        change directory to DIR after opening tape\n\
   -t            type out tape contents\n\
   -r            append files to tape\n\
   -x            extract files from tape\n\
+  -j N          convert files with N threads (0 => one per CPU)\n\
+  -F FMT        extract as its (default), simh, c36, h36 or auto[,FMT]\n\
+  -k DIR        cache parsed DIR.LIST files in DIR\n\
+  -T file       also save files listed in manifest (see itstar.doc)\n\
+  -I file       also save files in tar or cpio archive (- for STDIN)\n\
+  -X [cpio,]file  extract into tar (or cpio) archive (- for STDOUT)\n\
+  -i            build record index for tape image file\n\
   -f /dev/xxxx  specify local tape drive name\n\
   -f file       use tape image file instead\n\
   -f -          use STDIN/STDOUT for image file\n\
   -f HOST:DEV   use \"rmt\" remote tape server\n\
   -v            verify (display) names of all files accessed\n\
   -E            use E-11 tape image format\n\
+  -7            7-track tape image\n\
+  -p            check 7-track parity on read\n\
   -O            write old format tape (6 file header words)\n\
 \n");
 
@@ -630,29 +959,35 @@ switches:\n\
 	exit(rc);
 }
 
-/* write a 6-character ASCII string as a word of SIXBIT */
+/* convert a 6-character ASCII string to a word of SIXBIT */
 /* it is assumed that the string contains no non-sixbit characters */
-void outsix(char *s)
+uint64_t sixbit(char *s)
 {
-	unsigned long six[6], *p;
+	uint64_t w=0;
 	int i;
-	unsigned long l, r;
 
-	for(i=6,p=six;i--;*p++=0L);	/* init in case < 6 chars */
-	for(i=6,p=six;*s&&i--;*p++=((*s++-040)&077));  /* ASCII char -40 */
-	l=(six[0]<<12L)|(six[1]<<6L)|six[2];  /* pack it all up */
-	r=(six[3]<<12L)|(six[4]<<6L)|six[5];
-	outword(l,r);
+	for(i=0;i<6;i++) {		/* pad with blanks (0) if < 6 chars */
+		w<<=6;
+		if(*s) w|=(*s++-040)&077;  /* ASCII char -40 */
+	}
+	return(w);
 }
 
 /* read a 36-bit SIXBIT word as 0-6 ASCII characters */
 void insix(char *s)
+{
+	uint64_t w;
+
+	inwords(&w,1);			/* read it */
+	unsix(w,s);
+}
+
+/* convert 36-bit SIXBIT word W to 0-6 ASCII characters */
+static void unsix(uint64_t w,char *s)
 {
 	char *p;
 	int i;
-	unsigned long l, r;
-
-	inword(&l,&r);			/* read it */
+	unsigned long l=w>>18, r=w&0777777;
 
 	s[0]=((l>>12L)&077)+040;	/* unpack all six 6-bit bytes */
 	s[1]=((l>>6L)&077)+040;
@@ -1,22 +1,81 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
 void weenixname(char *p);
-void save(char *f);
+void save(char *f,FILE *in);
+struct stat;
+void addentry(char *f,struct stat *s);
+void walk(int argc,char **argv,char *d);
+void addmember(char *f,time_t mtime,time_t atime,char *link,FILE *in);
 
+void pickcodec();
 void resetbuf();
 void tapeflush();
 int taperead();
-void inword(long *l,long *r);
-void outword(register unsigned long l,register unsigned long r);
-int nextword(long *l,long *r);
+void inwords(uint64_t *w,int n);
+void skipwords(int n);
+int nextwords(uint64_t *w,int n);
+void outwords(uint64_t *w,int n);
 int remaining();
+void tapeskip();
+int recwords(int len);
+uint64_t recword(char *buf,int n);
+int decrec(char *buf,int len,uint64_t *w);
+int encrec(uint64_t *w,int n,char *buf);
 
 void opentape(char *name,int create,int writable);
 void closetape();
 void posnbot();
 void posneot(int);
 int getrec(char *buf,int len);
+int getrecp(char **bufp,int len);
+long long recoffset();
+void tapeseek(long long pos);
+int skiprec();
+void skipmark();
 void putrec(char *buf,int len);
 void tapemark();
 
+void dircache(char *d);
 int dirlist(int argc,char **argv,char *d);
+void manifest(char *name);
+void addmanifest();
+void tarin(char *name);
+void addarchive();
+void tarout(char *spec);
+int tarused(char *name);
+void tardir(char *d);
+void tarfile(char *name,char *buf,size_t len,time_t mtime);
+void tarlink(char *name,char *target);
+void tarend();
+void packformat(char *s);
 void pack(char *file);
+void packbuf(int fd,char *file,uint64_t *w,unsigned long n);
+void packmem(char *file,uint64_t *w,unsigned long n,char **buf,size_t *len);
 void unpack(char *file);
+void unpackstream(FILE *f,char *file);
+FILE *unpackopen(char *file);
+void unpackbuf(FILE *f,char *file,uint64_t **w,unsigned long *n);
+
+struct utimbuf;
+void startpool(int n,int saving);
+void extjob(int fd,char *file,uint64_t *words,unsigned long n,
+	struct utimbuf *u);
+void savejob(uint64_t *label,int len,FILE *f,char *file);
+void endpool();
+
+int zimage(char *p,int n);
+void zimgin(int fd,char *buf,unsigned long n);
+long zimgget(char *buf,unsigned long len);
+void zimgseek(long long pos);
+void zimgout(int fd,int threads);
+void zimgput(const void *buf,unsigned long len);
+void zimgend();
+FILE *zstream(FILE *f,char *file);
+FILE *zmemopen(char *buf,size_t len,char *file);
+
+void patterns(int argc,char **argv);
+int versions();
+int matchname(uint64_t *w);
+void pickversions(uint64_t (*names)[3],unsigned long n,char *want);
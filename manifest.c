@@ -0,0 +1,174 @@
+/*
+
+  Read a manifest of files to save, for -T.
+
+  Each line gives everything save() needs for one file, so nothing is
+  looked up on disk except the file's contents:
+
+	path	UFD	FN1	FN2	cdate	rdate	[LUFD	LFN1	LFN2]
+
+  separated by single tabs.  PATH is the UNIX file to save (only used in
+  messages if it's a link), UFD/FN1/FN2 are its ITS name (1-6 SIXBIT chars
+  each, lower case is folded to upper), the dates are ITS (Cambridge, MA)
+  local time as YYYYMMDDhhmmss, or "-" if there's none, and the three
+  optional fields make it a link to LUFD; LFN1 LFN2 instead of a file.
+  Blank lines and lines starting with "#" are ignored.
+
+  The manifest is read a line at a time (it may be compressed, or "-" for
+  STDIN), so it can be any length.
+
+  Entry points:
+  manifest, addmanifest.
+
+  This file is part of itstar.
+
+  itstar is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  itstar is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with itstar.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#define zopen apple_zopen
+#include <stdio.h>
+#undef zopen
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "itstar.h"
+
+FILE *zopen(char *);
+
+extern unsigned long islink;
+extern char ufd[7], fn1[7], fn2[7];
+extern char lufd[7], lfn1[7], lfn2[7];
+extern struct tm cdate, rdate;
+
+#define MAXLINE 8192		/* longest line (including NL) */
+#define NFIELDS 9		/* most fields on a line */
+
+static FILE *mf=NULL;		/* the manifest */
+static char *mname;		/* its name, for error messages */
+static unsigned long lineno;	/* current line #, for same */
+
+static void name(char *, char *), date(char *, struct tm *), punt(char *);
+
+/* open manifest NAME ("-" for STDIN) for addmanifest() */
+/* (done before -C changes directory, so NAME is where the user thinks) */
+void manifest(char *name)
+{
+	mname=name;
+	if(strcmp(name,"-")==0) mf=stdin;
+	else if((mf=zopen(name))==NULL) {
+		perror(name);
+		exit(1);
+	}
+}
+
+/* save all files listed in the manifest, if there is one */
+/* output buffer must have been initialized with resetbuf() */
+void addmanifest()
+{
+	static char line[MAXLINE+1];
+	char *f[NFIELDS];
+	char *p;
+	int n;
+
+	if(mf==NULL) return;
+	for(lineno=1;fgets(line,sizeof(line),mf)!=NULL;lineno++) {
+		if((p=strchr(line,'\n'))!=NULL) *p='\0';
+		else if(!feof(mf)) punt("line too long");
+		if(line[0]=='\0'||line[0]=='#') continue;
+
+		/* split at tabs */
+		for(n=0,p=line;;) {
+			if(n==NFIELDS) punt("too many fields");
+			f[n++]=p;
+			if((p=strchr(p,'\t'))==NULL) break;
+			*p++='\0';
+		}
+		if(n!=6&&n!=NFIELDS) punt("6 or 9 fields expected");
+		if(f[0][0]=='\0') punt("path expected");
+
+		name(f[1],ufd);
+		name(f[2],fn1);
+		name(f[3],fn2);
+		date(f[4],&cdate);
+		date(f[5],&rdate);
+		if((islink=(n==NFIELDS))) {
+			name(f[6],lufd);
+			name(f[7],lfn1);
+			name(f[8],lfn2);
+		}
+
+		save(f[0],NULL);
+	}
+	if(ferror(mf)) {
+		perror("?Error reading manifest");
+		exit(1);
+	}
+	if(mf!=stdin) fclose(mf);
+	mf=NULL;
+}
+
+/* check ITS filename element S and copy it to D (7 chars) */
+static void name(char *s,char *d)
+{
+	int i;
+	char c;
+
+	for(i=0;(c=s[i]);i++) {
+		if(i==6) punt("name longer than 6 characters");
+		if(c>='a'&&c<='z') c-='a'-'A';
+		if(c<' '||c>'_') punt("name isn't SIXBIT");
+		d[i]=c;
+	}
+	if(i==0) punt("name expected");
+	d[i]='\0';
+}
+
+/* parse date S (YYYYMMDDhhmmss or "-") into *T, the way save() wants it */
+/* (tm_year=0 means no date, as from DIR.LIST) */
+static void date(char *s,struct tm *t)
+{
+	int v[6];
+	static int len[6]={ 4, 2, 2, 2, 2, 2 };
+	int i, j;
+
+	memset(t,0,sizeof(struct tm));
+	if(strcmp(s,"-")==0) return;
+	for(i=0;i<6;i++)
+		for(v[i]=0,j=len[i];j--;s++) {
+			if(*s<'0'||*s>'9') punt("date must be YYYYMMDDhhmmss");
+			v[i]=v[i]*10+*s-'0';
+		}
+	if(*s) punt("date must be YYYYMMDDhhmmss");
+	/* (the label has 9 bits of year, see save()) */
+	if(v[0]<=1900||v[0]>=1900+512||v[1]<1||v[1]>12||v[2]<1||v[2]>31||
+		v[3]>23||v[4]>59||v[5]>59)
+		punt("date out of range");
+	t->tm_year=v[0]-1900;
+	t->tm_mon=v[1]-1;
+	t->tm_mday=v[2];
+	t->tm_hour=v[3];
+	t->tm_min=v[4];
+	t->tm_sec=v[5];
+}
+
+/* report a format error in the manifest and quit */
+static void punt(char *msg)
+{
+	fprintf(stderr,"?Format error in %s at line %lu:  %s\n",mname,lineno,
+		msg);
+	exit(1);
+}
@@ -0,0 +1,217 @@
+/*
+
+  Match ITS filenames from tape labels against patterns from the command line.
+
+  A pattern looks like an ITS filename:
+
+	[DEV:][UFD;][FN1] [FN2]
+
+  The device is ignored (everything on a DUMP tape came off the disk), and a
+  missing UFD, FN1 or FN2 matches anything.  "*" as a whole name matches anything,
+  and a name ending in "*" matches any name that starts with the rest of it.
+  ">" or "<" as the FN2 matches only the file with the highest or lowest
+  numeric FN2 among those with the same UFD and FN1, which can't be decided
+  until all the labels on the tape have been seen.
+
+  Each pattern is compiled into a mask and value for each of the three SIXBIT
+  words, so checking a label is just a few ANDs and compares.
+
+  Entry points:
+  patterns, versions, matchname, pickversions.
+
+  This file is part of itstar.
+
+  itstar is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  itstar is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with itstar.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "itstar.h"
+
+void nomem();
+
+struct pattern {
+	uint64_t mask[3];	/* bits that matter in UFD, FN1, FN2 */
+	uint64_t value[3];	/* what they must be */
+	int version;		/* '>' or '<' in place of FN2, or 0 */
+};
+
+static struct pattern *pats;	/* compiled patterns */
+static int npats=0;
+
+static char *name(char *, int, uint64_t *, uint64_t *);
+static long number(uint64_t);
+static int compare(const void *, const void *);
+
+static uint64_t (*sortnames)[3];  /* names being sorted by compare() */
+
+/* compile the ARGC patterns in ARGV (none at all means match everything) */
+void patterns(int argc,char **argv)
+{
+	struct pattern *p;
+	char *s, *q;
+
+	if((pats=malloc((argc?argc:1)*sizeof(struct pattern)))==NULL)
+		nomem();
+	for(npats=0;npats<argc;npats++) {
+		p=pats+npats;
+		s=argv[npats];
+		memset(p,0,sizeof(struct pattern));  /* all wild */
+
+		if((q=strchr(s,':'))!=NULL) s=q+1;  /* skip device */
+		if((q=strchr(s,';'))!=NULL) {	/* UFD given */
+			name(s,q-s,&p->mask[0],&p->value[0]);
+			s=q+1;
+		}
+		while(*s==' ') s++;		/* ITS allows "UFD; FN1" */
+		if((q=strchr(s,' '))==NULL) q=s+strlen(s);
+		name(s,q-s,&p->mask[1],&p->value[1]);  /* FN1 */
+		while(*q==' ') q++;
+		if((q[0]=='>'||q[0]=='<')&&q[1]=='\0')
+			p->version=q[0];	/* decide later */
+		else name(q,strlen(q),&p->mask[2],&p->value[2]);  /* FN2 */
+	}
+}
+
+/* return NZ if any pattern uses ">" or "<" (see pickversions()) */
+int versions()
+{
+	int i;
+
+	for(i=0;i<npats;i++)
+		if(pats[i].version) return(1);
+	return(0);
+}
+
+/* return NZ if label words W[1..3] (UFD, FN1, FN2) match a pattern */
+/* (patterns with ">" or "<" never match here, see pickversions()) */
+int matchname(uint64_t *w)
+{
+	struct pattern *p;
+	int i;
+
+	if(npats==0) return(1);		/* no patterns, want everything */
+	for(i=npats,p=pats;i--;p++)
+		if(!p->version&&
+			(w[1]&p->mask[0])==p->value[0]&&
+			(w[2]&p->mask[1])==p->value[1]&&
+			(w[3]&p->mask[2])==p->value[2]) return(1);
+	return(0);
+}
+
+/* given the UFD, FN1, FN2 words of all N files on the tape, set WANT[i] */
+/* to NZ for each file that matches a pattern, including ">" and "<" */
+void pickversions(uint64_t (*names)[3],unsigned long n,char *want)
+{
+	struct pattern *p;
+	unsigned long *v, nv, i, j, k;
+	long best;
+	uint64_t w[4];
+	int np;
+
+	for(i=0;i<n;i++) {		/* start with the plain patterns */
+		w[1]=names[i][0], w[2]=names[i][1], w[3]=names[i][2];
+		want[i]=matchname(w);
+	}
+
+	if((v=malloc((n?n:1)*sizeof(unsigned long)))==NULL) nomem();
+	sortnames=names;
+	for(np=npats,p=pats;np--;p++) {
+		if(!p->version) continue;
+
+		/* find numbered files with matching UFD and FN1 */
+		for(i=nv=0;i<n;i++)
+			if((names[i][0]&p->mask[0])==p->value[0]&&
+				(names[i][1]&p->mask[1])==p->value[1]&&
+				number(names[i][2])>=0) v[nv++]=i;
+
+		/* group by UFD;FN1, sorted by version within each */
+		qsort(v,nv,sizeof(unsigned long),compare);
+		for(i=0;i<nv;i=j) {
+			for(j=i+1;j<nv&&names[v[j]][0]==names[v[i]][0]&&
+				names[v[j]][1]==names[v[i]][1];j++) ;
+			/* v[i..j-1] is one group, want all copies of */
+			/* the highest (or lowest) version */
+			best=number(names[v[(p->version=='>')?j-1:i]][2]);
+			for(k=i;k<j;k++)
+				if(number(names[v[k]][2])==best) want[v[k]]=1;
+		}
+	}
+	free(v);
+}
+
+/* compile LEN chars of pattern name S into SIXBIT mask and value words */
+/* return pointer to first char after name */
+static char *name(char *s,int len,uint64_t *mask,uint64_t *value)
+{
+	int i, c;
+
+	*mask=*value=0;
+	if(len==0) return(s);		/* missing, match anything */
+	for(i=0;i<6;i++) {
+		if(i<len&&s[i]=='*'&&i==len-1)  /* wild from here on */
+			return(s+len);
+		c=(i<len)?toupper((unsigned char)s[i]):' ';
+		if(c<040||c>0137) {
+			fprintf(stderr,"?Invalid character in pattern:  %.*s\n",
+				len,s);
+			exit(1);
+		}
+		*mask|=(uint64_t)077<<(30-6*i);
+		*value|=(uint64_t)(c-040)<<(30-6*i);
+	}
+	if(len>6) {
+		fprintf(stderr,"?Name too long in pattern:  %.*s\n",len,s);
+		exit(1);
+	}
+	return(s+len);
+}
+
+/* return value of numeric SIXBIT filename W, or -1 if not all digits */
+static long number(uint64_t w)
+{
+	long n;
+	int i, c, digits;
+
+	for(n=0,i=digits=0;i<6;i++) {
+		c=((w>>(30-6*i))&077)+040;
+		if(c==' ') {			/* trailing blanks are OK */
+			if(((w<<(6*i))&0777777777777ULL)!=0) return(-1);
+			break;
+		}
+		if(c<'0'||c>'9') return(-1);
+		n=n*10+(c-'0');
+		digits++;
+	}
+	return(digits?n:-1);
+}
+
+/* qsort() comparison routine for pickversions() */
+/* sorts indexes into sortnames[] by UFD, FN1 and numeric FN2 */
+static int compare(const void *a,const void *b)
+{
+	uint64_t *x=sortnames[*(unsigned long *)a],
+		*y=sortnames[*(unsigned long *)b];
+	long vx, vy;
+
+	if(x[0]!=y[0]) return(x[0]<y[0]?-1:1);
+	if(x[1]!=y[1]) return(x[1]<y[1]?-1:1);
+	vx=number(x[2]), vy=number(y[2]);
+	return((vx>vy)-(vx<vy));
+}
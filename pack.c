@@ -1,6 +1,27 @@
 /*
 
-  Pack an ITS file into a WEENIX file using Alan Bawden's evacuated file format.
+  Pack an ITS file into a WEENIX file using Alan Bawden's evacuated file format,
+  or (with -F) one of the raw 36-bit formats used by emulators:
+
+	its	evacuated format (the default)
+	simh	8 bytes per word, 64-bit little-endian (SIMH memory images)
+	c36	5 bytes per word, "core-dump" order (bits 0-31, then 32-35
+		right-justified in the 5th byte)
+	h36	9 bytes per 2 words, "high-density" (KLH10), an odd last word
+		goes out as 5 bytes with the low 4 bits of the 5th byte zero
+	auto	evacuated format for text files, SIMH for binary ones
+		("auto,c36" or "auto,h36" to use another raw format)
+
+  A file counts as binary if any of its first 1024 words has bit 35 set,
+  since the ASCII that evacuated format is meant to keep readable never has.
+
+  pack() reads the file from the tape itself.  packbuf() takes words that
+  have already been read (see pool.c), and can run in several threads at
+  once since everything about the file being written is thread-local.
+  packmem() is the same but packs into memory (for -X, see tarout.c).
+
+  Entry points:
+  packformat, pack, packbuf, packmem.
 
   By John Wilson.
 
@@ -24,6 +45,7 @@
 */
 
 #include <fcntl.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/stat.h>
@@ -31,9 +53,15 @@
 #include <sys/wait.h>
 #include <time.h>
 #include <string.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "itstar.h"
 
+void nomem();
+
 /* macro to send one byte to output file */
 #define outbyte(c) outbuf[outcnt++]=c
 /* macro to flush byte stored in PREV after we discover sequence won't work */
@@ -42,11 +70,33 @@
         else if(prev==0177) outbyte(0357);\
 	prev=0;
 
-static FILE *out;
-static void outwrd();
-static int outcnt;	/* # chars saved in OUTBUF */
-static char outbuf[5+1];  /* chars written since last word boundary */
-			/* +1 is for char from PREV */
+/* output is collected in OUTBUF and written in big chunks */
+/* (each word makes at most 5 bytes, plus 1 for a char from PREV) */
+#define OUTBUFLEN (64*1024)
+static _Thread_local int out;	/* output file descriptor, -1 for MEM */
+static _Thread_local char *name;  /* its name, for error messages */
+static void packbegin(int, char *, uint64_t *, int), packmore(uint64_t *, int),
+	packend(), packwords(uint64_t *, int), rawwords(uint64_t *, int),
+	outwrd();
+static int plainwords(uint64_t *, int, char *);
+static _Thread_local int outcnt;  /* # chars saved in OUTBUF */
+static _Thread_local int wordcnt;  /* OUTCNT when current word was started */
+static _Thread_local unsigned char prev;  /* 015 or 177 from prev char, or 0 */
+static _Thread_local char outbuf[OUTBUFLEN];
+static _Thread_local char *mem;	/* where packmem() packs the file */
+static _Thread_local size_t memlen, memmax;  /* # bytes in MEM, its size */
+
+/* output formats (see -F) */
+#define ITS 0
+#define SIMH 1
+#define C36 2
+#define H36 3
+static char *fmtnames[]={ "its", "simh", "c36", "h36", NULL };
+static int fmt=ITS;	/* format chosen with -F */
+static int autofmt=0;	/* NZ => text in ITS format, binary in FMT */
+static _Thread_local int curfmt;  /* format of file being written */
+static _Thread_local uint64_t odd;  /* H36 word waiting for its partner */
+static _Thread_local int haveodd;  /* NZ => ODD is valid */
 
 /*
  
@@ -192,51 +242,186 @@ static unsigned char pfx177[128] = {
 	0000,0000,0000,0000,0000,0000,0000,0207		/* 170 */
 };
 
+/* set output format from -F argument S, see above */
+void packformat(char *s)
+{
+	char *p;
+	int i;
+
+	autofmt=0;
+	fmt=ITS;
+	if(strncmp(s,"auto",4)==0&&(s[4]=='\0'||s[4]==',')) {
+		autofmt=1;
+		fmt=SIMH;		/* unless "auto,fmt" */
+		if(s[4]=='\0') return;
+		s+=5;
+	}
+	for(i=0;(p=fmtnames[i])!=NULL;i++)
+		if(strcmp(s,p)==0) break;
+	if(p==NULL||(autofmt&&i==ITS)) {
+		fprintf(stderr,"?Invalid output format:  %s\n",s);
+		exit(1);
+	}
+	fmt=i;
+}
+
 /* pack tape data into WEENIX form, creating a file named FILE */
 void pack(char *file)
 {
-	register unsigned char c, d, prev;
-	register int i;
-	static char inbuf[5];
-	unsigned long l, r;
-	char *p;
+	static uint64_t words[1024];	/* a record's worth at a time */
+	int fd, n, k;
 
-	out=fopen(file,"wb");	/* create output file */
-	if(out==NULL) {
+	fd=open(file,O_WRONLY|O_CREAT|O_TRUNC,0666);  /* create output file */
+	if(fd<0) {
 		perror(file);
 		exit(1);
 	}
 
 	if((remaining()==0)&&(taperead()<0)) {
-				/* read first rec for nextword() */
-		fclose(out);	/* null file, we're done */
+				/* read first rec for nextwords() */
+		close(fd);	/* null file, we're done */
 		return;
 	}
 
-	outcnt=0;		/* nothing has gone out yet */
-	for(prev=0;;) {
-		if(nextword(&l,&r)<0) {
-			flushprev();
+	/* get the first 1024 words (or the whole file) for packbegin() */
+	/* (stopping at the tape mark, since nextwords() would go on */
+	/* to the next file after that) */
+	for(n=0;n<1024;n+=k)
+		if((k=nextwords(words+n,1024-n))<=0) break;
+	packbegin(fd,file,words,n);
+	packmore(words,n);
+	if(n==1024)
+		while((n=nextwords(words,sizeof(words)/sizeof(words[0])))>0)
+			packmore(words,n);
+	packend();
+}
+
+/* pack the N words in W[] into the file FILE, already open on FD */
+/* (the file is closed when done) */
+void packbuf(int fd,char *file,uint64_t *w,unsigned long n)
+{
+	unsigned long k;
+
+	packbegin(fd,file,w,n<1024?n:1024);
+	for(;n>0;w+=k,n-=k) {
+		k=n<0100000?n:0100000;
+		packmore(w,k);
+	}
+	packend();
+}
+
+/* pack the N words in W[] (the file FILE) into memory, set *BUF to the */
+/* result (malloc()ed) and *LEN to its length */
+void packmem(char *file,uint64_t *w,unsigned long n,char **buf,size_t *len)
+{
+	memmax=64*1024;
+	if((mem=malloc(memmax))==NULL) nomem();
+	memlen=0;
+	packbuf(-1,file,w,n);
+	*buf=mem, *len=memlen;
+}
+
+/* start packing into FD (called FILE), the first N words (up to 1024 */
+/* of them) are in W[], to decide whether -F auto means text or binary */
+static void packbegin(int fd,char *file,uint64_t *w,int n)
+{
+	int i;
+
+	out=fd;
+	name=file;
+	outcnt=wordcnt=0;	/* nothing has gone out yet */
+	prev=0;
+	haveodd=0;
+	curfmt=fmt;
+	if(autofmt) {		/* text unless b35 is set somewhere */
+		for(i=0;i<n&&(w[i]&1)==0;i++) ;
+		if(i==n) curfmt=ITS;
+	}
+}
+
+/* pack the next N words of the file from W[] */
+static void packmore(uint64_t *w,int n)
+{
+	if(curfmt==ITS) packwords(w,n);
+	else rawwords(w,n);
+}
+
+/* finish the file, flush it and close it */
+static void packend()
+{
+	if(curfmt==ITS) {
+		flushprev();
+		/* trim off trailing ^Cs from last word */
+		/* note that there may be a PREV character inherited from */
+		/* the prev word, but it can't be ^C (since PREV is only for */
+		/* 015 and 177) so we won't screw up the previous word if */
+		/* the file ends with 6 ^Cs */
+		while(outcnt>wordcnt&&outbuf[outcnt-1]==003) outcnt--;
+	}
+	else if(haveodd) {	/* odd word at end of H36 file */
+		if(outcnt>OUTBUFLEN-5) outwrd();
+		outbyte(odd>>28);
+		outbyte(odd>>20);
+		outbyte(odd>>12);
+		outbyte(odd>>4);
+		outbyte((odd&017)<<4);
+	}
+	outwrd();		/* flush bytes from final word, if any */
+
+	if(out>=0&&close(out)<0) {
+		perror("?File write error");
+		exit(1);
+	}
+}
+
+/* pack the N words in W[] into OUTBUF */
+static void packwords(uint64_t *w,int n)
+{
+	register unsigned char c, d;
+	register int i;
+	register uint64_t x;
+	register char *p;
+	char inbuf[5];
+	int k;
+
+	while(n>0) {
+		/* starting a new word, everything before it is final */
+		if(outcnt>OUTBUFLEN-6) outwrd();
+		wordcnt=outcnt;
+
+		/* fast path for a run of words of plain ASCII that go out */
+		/* as is (see plainwords()) */
+		if(!prev) {
+			k=(OUTBUFLEN-3-outcnt)/5;  /* room for this many */
+			k=plainwords(w,(k<n)?k:n,outbuf+outcnt);
+			outcnt+=5*k;
+			w+=k, n-=k;
+		}
+		if(n==0) {		/* run ended the block */
+			wordcnt=outcnt-5;  /* last word is still open */
 			break;
 		}
-		outwrd();	/* starting a new word, flush previous */
-		if(r&1) {	/* b35 set => can't be ASCII */
+		if(outcnt!=wordcnt) continue;  /* buffer full, flush it */
+
+		/* anything else goes through the table */
+		x=*w++, n--;
+		if(x&1) {	/* b35 set => can't be ASCII */
 			flushprev();
 			/* pack up a quoted word */
-			outbyte(0360L|((l>>14L)&0017L));
-			outbyte((l>>6L)&0377L);
-			outbyte(((l<<2L)&0374L)|((r>>16L)&0003L));
-			outbyte((r>>8L)&0377L);
-			outbyte(r&0377L);
+			outbyte(0360|((x>>32)&0017));
+			outbyte((x>>24)&0377);
+			outbyte((x>>16)&0377);
+			outbyte((x>>8)&0377);
+			outbyte(x&0377);
 			continue;
 		}
 
 		/* unpack word into five ASCII bytes */
-		inbuf[0]=(l>>11L)&0177L;
-		inbuf[1]=(l>>4L)&0177L;
-		inbuf[2]=((l<<3L)&0170L)|((r>>15L)&0007L);
-		inbuf[3]=(r>>8L)&0177L;
-		inbuf[4]=(r>>1L)&0177L;
+		inbuf[0]=(x>>29)&0177;
+		inbuf[1]=(x>>22)&0177;
+		inbuf[2]=(x>>15)&0177;
+		inbuf[3]=(x>>8)&0177;
+		inbuf[4]=(x>>1)&0177;
 
 		/* process each byte */
 		for(p=inbuf,i=sizeof(inbuf);i--;) {
@@ -267,25 +452,152 @@ void pack(char *file)
 			outbyte(d);
 		}
 	}
-	/* trim off trailing ^Cs from last word */
-	/* note that there may be a PREV character inherited from the prev */
-	/* word, but it can't be ^C (since PREV is only for 015 and 177) so */
-	/* we won't screw up the previous word if the file ends with 6 ^Cs */
-	while(outcnt&&outbuf[outcnt-1]==003) outcnt--;
-	outwrd();		/* flush bytes from final word, if any */
+}
 
-	fclose(out);
-	return;
+/* find the run of words at the start of W[] (up to N of them) that are */
+/* plain ASCII, i.e. b35 clear and none of the five chars is 012, 015 or */
+/* 177, since all other 7-bit chars are written as themselves (as long as */
+/* they don't follow 015 or 177, which is the caller's problem) */
+/* store their chars at P (may write up to 3 extra bytes) and return # words */
+static int plainwords(uint64_t *w,int n,char *p)
+{
+	register uint64_t x, t, v;
+	int k=0;
+#ifdef __SSE2__
+	__m128i y, z, bad;
+#endif
+
+#ifdef SCALAR			/* reference build for "make test" */
+	return(0);
+#endif
+#ifdef __SSE2__
+	/* two words at a time, spreading each word's chars into bytes 0-4 */
+	/* of its 64-bit lane and comparing them all at once */
+	for(;k+2<=n;k+=2,p+=10) {
+		if((w[k]|w[k+1])&1) break;
+		y=_mm_srli_epi64(_mm_loadu_si128((__m128i *)(w+k)),1);
+		z=_mm_or_si128(_mm_or_si128(
+			_mm_and_si128(_mm_srli_epi64(y,28),_mm_set1_epi64x(0177)),
+			_mm_and_si128(_mm_srli_epi64(y,13),
+				_mm_set1_epi64x(0177LL<<8))),
+			_mm_or_si128(_mm_or_si128(
+			_mm_and_si128(_mm_slli_epi64(y,2),
+				_mm_set1_epi64x(0177LL<<16)),
+			_mm_and_si128(_mm_slli_epi64(y,17),
+				_mm_set1_epi64x(0177LL<<24))),
+			_mm_and_si128(_mm_slli_epi64(y,32),
+				_mm_set1_epi64x(0177LL<<32))));
+		bad=_mm_or_si128(_mm_or_si128(
+			_mm_cmpeq_epi8(z,_mm_set1_epi8(012)),
+			_mm_cmpeq_epi8(z,_mm_set1_epi8(015))),
+			_mm_cmpeq_epi8(z,_mm_set1_epi8(0177)));
+		if(_mm_movemask_epi8(bad)) break;
+		_mm_storel_epi64((__m128i *)p,z);
+		_mm_storel_epi64((__m128i *)(p+5),_mm_unpackhi_epi64(z,z));
+	}
+#endif
+	/* one word at a time, same idea in a 64-bit integer */
+	/* (with the usual trick to find a zero byte, applied to T XOR each */
+	/* char we're looking for, only the low 5 bytes matter) */
+	for(;k<n;k++,p+=5) {
+		x=w[k];
+		if(x&1) break;
+		x>>=1;
+		t=((x>>28)&0177)|((x>>13)&(0177<<8))|((x<<2)&(0177L<<16))|
+			((x<<17)&(0177ULL<<24))|((x<<32)&(0177ULL<<32));
+#define HASZERO(v) (((v)-0x0101010101ULL)&~(v)&0x8080808080ULL)
+		v=t^0x0A0A0A0A0AULL;
+		if(HASZERO(v)) break;
+		v=t^0x0D0D0D0D0DULL;
+		if(HASZERO(v)) break;
+		v=t^0x7F7F7F7F7FULL;
+		if(HASZERO(v)) break;
+#undef HASZERO
+		p[0]=t, p[1]=t>>8, p[2]=t>>16, p[3]=t>>24, p[4]=t>>32;
+	}
+	return(k);
 }
 
-/* flush all bytes saved in OUTBUF to the output file, and set OUTCNT=0 */
+/* write the N words in W[] to OUTBUF in raw format CURFMT */
+static void rawwords(uint64_t *w,int n)
+{
+	register uint64_t x;
+	register unsigned char *p;
+	int k;
+
+	while(n>0) {
+		if(outcnt>OUTBUFLEN-16) outwrd();
+		k=(OUTBUFLEN-outcnt)/9;	/* room for this many words */
+		if(k>n) k=n;
+		n-=k;
+		p=(unsigned char *)outbuf+outcnt;
+		switch(curfmt) {
+		case SIMH:
+#if defined(__BYTE_ORDER__)&&__BYTE_ORDER__==__ORDER_LITTLE_ENDIAN__
+			memcpy(p,w,k*8);  /* already in the right order */
+			p+=k*8, w+=k;
+#else
+			for(;k--;p+=8) {
+				x=*w++;
+				p[0]=x, p[1]=x>>8, p[2]=x>>16, p[3]=x>>24;
+				p[4]=x>>32, p[5]=p[6]=p[7]=0;
+			}
+#endif
+			break;
+		case C36:
+			for(;k--;p+=5) {
+				x=*w++;
+				p[0]=x>>28, p[1]=x>>20, p[2]=x>>12, p[3]=x>>4;
+				p[4]=x&017;
+			}
+			break;
+		case H36:
+			if(haveodd&&k) {  /* finish pair from last time */
+				x=*w++, k--;
+				p[0]=odd>>28, p[1]=odd>>20, p[2]=odd>>12;
+				p[3]=odd>>4, p[4]=((odd&017)<<4)|(x>>32);
+				p[5]=x>>24, p[6]=x>>16, p[7]=x>>8, p[8]=x;
+				p+=9;
+				haveodd=0;
+			}
+			for(;k>=2;k-=2,p+=9) {
+				x=*w++;
+				p[0]=x>>28, p[1]=x>>20, p[2]=x>>12, p[3]=x>>4;
+				p[4]=(x&017)<<4;
+				x=*w++;
+				p[4]|=x>>32;
+				p[5]=x>>24, p[6]=x>>16, p[7]=x>>8, p[8]=x;
+			}
+			if(k) {		/* save odd word for next time */
+				odd=*w++;
+				haveodd=1;
+			}
+			break;
+		}
+		outcnt=p-(unsigned char *)outbuf;
+	}
+}
+
+/* write all bytes saved in OUTBUF to the output file, and set OUTCNT=0 */
 static void outwrd()
 {
 	char *p;
-	for(p=outbuf;outcnt;outcnt--) {	/* write out all stored bytes */
-		if(putc(*p++,out)==EOF) {
+	int n;
+
+	if(out<0) {		/* packmem(), just add them on */
+		if(memlen+outcnt>memmax) {
+			while(memlen+outcnt>memmax) memmax*=2;
+			if((mem=realloc(mem,memmax))==NULL) nomem();
+		}
+		memcpy(mem+memlen,outbuf,outcnt);
+		memlen+=outcnt;
+		outcnt=wordcnt=0;
+		return;
+	}
+	for(p=outbuf;outcnt;outcnt-=n,p+=n)
+		if((n=write(out,p,outcnt))<=0) {
 			perror("?File write error");
 			exit(1);
 		}
-	}
+	wordcnt=0;
 }
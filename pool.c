@@ -0,0 +1,286 @@
+/*
+
+  Pools of threads that convert files, for -x, -c and -r with -j.
+
+  Extracting:  the main thread still reads the tape and does everything that
+  has to happen in tape order:  parsing labels, choosing the UNIX filename
+  (and renaming it if it's already there), making directories and symlinks,
+  and creating each file.  So the names on disk are exactly what they would
+  be without -j.  What's left over -- packing the words into the chosen
+  format, writing them out, closing the file and setting its dates -- is
+  queued for the workers, along with the file's words (already decoded from
+  the tape).
+
+  Saving:  the main thread still walks the directories (and DIR.LIST files)
+  in order, makes up each label and opens each file, and queues them.  The
+  workers unpack the files into memory (decompressing them if needed), and
+  one more thread writes each label and file to the tape, in the order they
+  were queued, as soon as the file's words are ready.  So the tape is
+  exactly what it would be without -j.
+
+  The queue holds at most QFILES files (each of which has an open
+  descriptor), and the main thread waits for the others to catch up when
+  it's full.  Workers wait before taking another file if QWORDS words are
+  already waiting to be written (files bigger than that are still OK).
+
+  Entry points:
+  startpool, extjob, savejob, endpool.
+
+  This file is part of itstar.
+
+  itstar is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  itstar is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with itstar.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <utime.h>
+
+#include "itstar.h"
+
+void nomem();
+
+#define QWORDS (8L*1024*1024)	/* max words waiting to be written */
+#define QFILES 256		/* max files in the queue */
+
+struct job {			/* one file to be written */
+	struct job *next;
+	char *name;		/* its name */
+	uint64_t *words;	/* its contents */
+	unsigned long n;	/* # words in WORDS[] */
+	/* for extjob() */
+	int fd;			/* file, already created */
+	int dates;		/* NZ => set dates from U */
+	struct utimbuf u;
+	/* for savejob() */
+	FILE *f;		/* file, already opened (NULL if link) */
+	uint64_t label[10];	/* label, plus link target if link */
+	int len;		/* # words in LABEL[] */
+	int ready;		/* NZ => WORDS[] is ready to be written */
+};
+
+static pthread_mutex_t lock=PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work=PTHREAD_COND_INITIALIZER;  /* for workers */
+static pthread_cond_t room=PTHREAD_COND_INITIALIZER;  /* for main thread */
+static pthread_cond_t ready=PTHREAD_COND_INITIALIZER;  /* for tape writer */
+static struct job *head=NULL, *tail=NULL;  /* queue */
+static struct job *next=NULL;	/* first job no worker has taken yet */
+static unsigned long qwords=0;	/* # words waiting to be written */
+static int qfiles=0;		/* # files in queue or being written */
+static int done=0;		/* NZ => no more jobs are coming */
+
+static pthread_t *workers=NULL, writer;
+static int nworkers=0;
+static int saving;		/* NZ => saving files, not extracting */
+
+static void *extworker(void *), *saveworker(void *), *tapewriter(void *);
+static void enqueue(struct job *);
+
+/* start N worker threads, for saving files if SAVE is NZ */
+/* (plus one to write the tape) or else for extracting them */
+void startpool(int n,int save)
+{
+	int i;
+
+	saving=save;
+	done=0;
+	if((workers=malloc(n*sizeof(pthread_t)))==NULL) nomem();
+	for(nworkers=0;nworkers<n;nworkers++)
+		if((i=pthread_create(&workers[nworkers],NULL,
+			saving?saveworker:extworker,NULL))!=0) goto fail;
+	if(saving&&(i=pthread_create(&writer,NULL,tapewriter,NULL))!=0)
+		goto fail;
+	return;
+fail:
+	fprintf(stderr,"?Can't start thread:  %s\n",strerror(i));
+	exit(1);
+}
+
+/* queue the N words in WORDS[] (malloc()ed, freed when written) to be */
+/* packed into FILE, already open on FD, then set its dates from U if */
+/* it's not NULL */
+void extjob(int fd,char *file,uint64_t *words,unsigned long n,
+	struct utimbuf *u)
+{
+	struct job *j;
+
+	if((j=malloc(sizeof(struct job)))==NULL) nomem();
+	if((j->name=strdup(file))==NULL) nomem();
+	j->fd=fd;
+	j->words=words;
+	j->n=n;
+	if((j->dates=(u!=NULL))) j->u=*u;
+
+	pthread_mutex_lock(&lock);
+	while(qfiles&&qwords+n>QWORDS)  /* (QFILES is checked too) */
+		pthread_cond_wait(&room,&lock);
+	qwords+=n;
+	enqueue(j);
+	pthread_mutex_unlock(&lock);
+}
+
+/* queue the LEN label words in LABEL[] (including the link target if */
+/* it's a link) to be written to the tape, followed by the contents of */
+/* FILE, already open as F (NULL if it's a link), and a tape mark */
+void savejob(uint64_t *label,int len,FILE *f,char *file)
+{
+	struct job *j;
+
+	if((j=malloc(sizeof(struct job)))==NULL) nomem();
+	if((j->name=strdup(file))==NULL) nomem();
+	memcpy(j->label,label,len*sizeof(uint64_t));
+	j->len=len;
+	j->f=f;
+	j->words=NULL;
+	j->n=0;
+	j->ready=0;
+
+	pthread_mutex_lock(&lock);
+	enqueue(j);
+	pthread_mutex_unlock(&lock);
+}
+
+/* add job J to the queue, waiting for room first (LOCK must be held) */
+static void enqueue(struct job *j)
+{
+	while(qfiles>=QFILES) pthread_cond_wait(&room,&lock);
+	j->next=NULL;
+	if(tail) tail->next=j;
+	else head=j;
+	tail=j;
+	if(next==NULL) next=j;
+	qfiles++;
+	pthread_cond_signal(&work);
+}
+
+/* wait for all queued files to be written, and stop the threads */
+void endpool()
+{
+	int i;
+
+	if(!nworkers) return;
+	pthread_mutex_lock(&lock);
+	done=1;
+	pthread_cond_broadcast(&work);
+	pthread_cond_signal(&ready);
+	pthread_mutex_unlock(&lock);
+	for(i=0;i<nworkers;i++) pthread_join(workers[i],NULL);
+	if(saving) pthread_join(writer,NULL);
+	free(workers);
+	nworkers=0;
+}
+
+/* extract worker thread, write files until there aren't any more */
+static void *extworker(void *arg)
+{
+	struct job *j;
+
+	for(;;) {
+		pthread_mutex_lock(&lock);
+		while(next==NULL&&!done) pthread_cond_wait(&work,&lock);
+		if((j=next)==NULL) {	/* done, and nothing left */
+			pthread_mutex_unlock(&lock);
+			return(NULL);
+		}
+		/* (nothing else needs the queue, so take it off) */
+		if((head=next=j->next)==NULL) tail=NULL;
+		pthread_mutex_unlock(&lock);
+
+		packbuf(j->fd,j->name,j->words,j->n);
+		if(j->dates&&utime(j->name,&j->u)<0) {
+			perror("?Error setting file dates");
+			exit(1);
+		}
+
+		pthread_mutex_lock(&lock);
+		qwords-=j->n;
+		qfiles--;
+		pthread_cond_signal(&room);
+		pthread_mutex_unlock(&lock);
+		free(j->words);
+		free(j->name);
+		free(j);
+	}
+}
+
+/* save worker thread, unpack files into memory for tapewriter() */
+static void *saveworker(void *arg)
+{
+	struct job *j;
+
+	for(;;) {
+		pthread_mutex_lock(&lock);
+		/* (if there's no room, the tape writer must have files */
+		/* to write, and will make room) */
+		while((next==NULL&&!done)||(next&&qwords>=QWORDS))
+			pthread_cond_wait(&work,&lock);
+		if((j=next)==NULL) {	/* done, and nothing left */
+			pthread_mutex_unlock(&lock);
+			return(NULL);
+		}
+		next=j->next;		/* leave it in queue for writer */
+		pthread_mutex_unlock(&lock);
+
+		if(j->f) unpackbuf(j->f,j->name,&j->words,&j->n);
+
+		pthread_mutex_lock(&lock);
+		j->ready=1;
+		qwords+=j->n;
+		pthread_cond_signal(&ready);
+		pthread_mutex_unlock(&lock);
+	}
+}
+
+/* tape writer thread, write files to tape in order as they're unpacked */
+static void *tapewriter(void *arg)
+{
+	struct job *j;
+	unsigned long n;
+	int k;
+
+	for(;;) {
+		pthread_mutex_lock(&lock);
+		while((head==NULL&&!done)||(head&&!head->ready))
+			pthread_cond_wait(&ready,&lock);
+		if((j=head)==NULL) {	/* done, and nothing left */
+			pthread_mutex_unlock(&lock);
+			return(NULL);
+		}
+		pthread_mutex_unlock(&lock);
+
+		/* same as save() does */
+		outwords(j->label,j->len);
+		for(n=0;n<j->n;n+=k) {
+			k=(j->n-n<0100000)?j->n-n:0100000;
+			outwords(j->words+n,k);
+		}
+		tapeflush();		/* finish off final record */
+		tapemark();		/* write EOF */
+
+		pthread_mutex_lock(&lock);
+		if((head=j->next)==NULL) tail=NULL;
+		qwords-=j->n;
+		qfiles--;
+		pthread_cond_signal(&room);
+		pthread_cond_broadcast(&work);
+		pthread_mutex_unlock(&lock);
+		free(j->words);
+		free(j->name);
+		free(j);
+	}
+}
@@ -7,9 +7,15 @@
   There are no per-instance variables, so only a single magtape can be active
   at any one time.
 
+  Image files that can't be mapped (including pipes, which can't be seeked
+  on either) are read through a big buffer, so a record costs one read() or
+  less instead of three.  Compressed image files go through the same
+  buffer, with zimage.c doing the reading (and writing).
+
   Entry points:
 
-  opentape, closetape, posnbot, posneot, getrec, putrec, tapemark.
+  opentape, closetape, posnbot, posneot, tapeseek, getrec, getrecp, skiprec,
+  skipmark, putrec, tapemark.
 
   08/10/1993  JMBW  IBM mainframe TCP socket stuff (was using many files).
   07/08/1994  JMBW  Local magtape code.
@@ -39,12 +45,15 @@
 #include <sys/types.h>
 #include <netinet/in.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/uio.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <fcntl.h>
+#include <stdint.h>
 #include <unistd.h>	/* for lseek() SEEK_SET, SEEK_END under Linux */
 
 #ifdef _AIX /* maybe this will be enough to make it compile on AIX */
@@ -82,6 +91,7 @@ struct mtop { int mt_op; int mt_count; };
 #endif
 
 #include "tapsrv.h"	/* get TAPESRV command opcodes */
+#include "tapidx.h"
 
 /* default tape drive device name */
 #define TAPE "/dev/nrmt0"
@@ -91,6 +101,15 @@ struct mtop { int mt_op; int mt_count; };
 void nomem();
 
 static void doread(int, char *, int), dowrite(int, char *, int), sendcode(int), getrc();
+static void mapimage(), imgput(const void *, int), imgflush(), toolong(unsigned long);
+static void imgseek(off_t), zipimage(int);
+static char *rdspace(unsigned long), *imgget(unsigned long);
+int getrec(char *, int);
+void pickcodec();
+int zimage(char *, int);
+void zimgin(int, char *, unsigned long), zimgseek(long long);
+void zimgout(int, int), zimgput(const void *, unsigned long), zimgend();
+long zimgget(char *, unsigned long);
 static int response(), doioctl(struct mtop *);
 void tapemark();
 
@@ -102,6 +121,8 @@ int simh=1;		/* NZ => SIMH file format (records padded to even */
 			/* lengths) */
 			/* 0 => Ersatz-11 file format (no padding) */
 extern int big_endian;
+extern int jobs;
+extern unsigned long nrecs;
 
 /* magtape commands */
 static struct mtop mt_weof={ MTWEOF, 1 }; /* operation, count */
@@ -121,9 +142,39 @@ static int tapefile=0;	/* NZ => file containing image of a tape */
 static int tapesock=0;	/* NZ => MTS TAPESRV tape server through TCP socket */
 static int tapermt=0;	/* NZ => WEENIX rmt tape server */
 static int tapefd;	/* tape drive, file, or socket file descriptor */
+static int tapestream=0;  /* NZ => image file is a pipe (can't seek) */
+static int tapezip=0;	/* NZ => image file is compressed (see zimage.c) */
+
+static off_t tapepos;	/* offset of next record in image file */
+static off_t recpos=(-1);	/* offset of last record read, -1 if none */
+
+/* read-only image files are mapped into memory if possible, so that records */
+/* can be handed to the caller in place instead of read() into a buffer */
+static char *tapemap=NULL;  /* base of mapped image, NULL if not mapped */
+static size_t tapemaplen;  /* length of mapped image */
 
 static int waccess;	/* NZ => tape opened for write access access */
 
+/* records that aren't mapped are read into this buffer, which grows as */
+/* needed to fit the biggest record seen so far */
+#define MAXRECLEN 0xFFFFFFL	/* SIMH record lengths are 24 bits */
+static char *rdbuf=NULL;
+static unsigned long rdlen=0;	/* size of rdbuf[] */
+
+/* image files that aren't mapped (pipes, mostly) are read in big chunks */
+/* into this buffer, which grows to hold the biggest record seen, so that */
+/* records can be handed to the caller in place the same as if mapped */
+#define INBUFLEN (256*1024)
+static char *inbuf=NULL;
+static unsigned long inlen=0;	/* size of inbuf[] */
+static unsigned long inptr=0, inend=0;  /* next byte, end of data in inbuf[] */
+
+/* records and tape marks written to image files are assembled here and */
+/* written in big chunks, rather than with several write()s per record */
+#define IMGBUFLEN (256*1024)
+static char imgbuf[IMGBUFLEN];
+static int imgcnt=0;	/* # bytes waiting in imgbuf[] */
+
 unsigned long count;	/* count of frames written to tape */
 
 static struct sockaddr_in addr;  /* socket addr structure for remote TAPESRV */
@@ -135,6 +186,7 @@ void opentape(char *name,int create,int writable)
 	char *p, *host, *user, *port;
 	int len;
 
+	pickcodec();				/* decide how words are stored */
 	waccess=writable;			/* remember if we're writing */
 	count=0;				/* nothing transferred yet */
 
@@ -170,6 +222,13 @@ void opentape(char *name,int create,int writable)
 			perror("?Open failure");
 			exit(1);
 		}
+		tapepos=0;
+		if(tapefile)		/* pipes are read/written in order */
+			tapestream=(lseek(tapefd,0L,SEEK_CUR)<0);
+		if(tapefile) zipimage(create);
+		if(tapefile&&!writable&&!tapezip) mapimage();
+		if(tapefile&&!tapestream&&strcmp(tape,"-")!=0)
+			idxopen(tape,tapefd,create,writable);
 	}
 	else {	/* "rmt" tape server on remote host */
 /*		tapesock++; */
@@ -256,13 +315,70 @@ void opentape(char *name,int create,int writable)
 	}
 }
 
+/* see if the image file is compressed, set TAPEZIP and get zimage.c */
+/* going if so (new images are compressed if their names end in ".gz") */
+static void zipimage(int create)
+{
+	char magic[2];
+	int l;
+
+	if(create) {
+		l=strlen(tape);
+		if(l<3||strcmp(tape+l-3,".gz")!=0) return;
+		tapezip=1;
+		zimgout(tapefd,jobs);
+		return;
+	}
+	if(tapestream) {	/* peek at the start of the pipe */
+		if(waccess) return;
+		imgget(2);
+		inptr=0;
+		if(!zimage(inbuf,inend)) return;
+		zimgin(tapefd,inbuf,inend);
+		inend=0;
+	}
+	else {
+		if(pread(tapefd,magic,2,0)!=2||!zimage(magic,2)) return;
+		if(waccess) {
+			fprintf(stderr,
+				"?Can't append to a compressed tape image\n");
+			exit(1);
+		}
+		zimgin(tapefd,magic,0);
+	}
+	tapezip=1;
+}
+
+/* try to map a read-only image file into memory */
+/* (quietly leave it unmapped if it's not a regular file, e.g. a pipe) */
+static void mapimage()
+{
+	struct stat s;
+	void *p;
+
+	if(fstat(tapefd,&s)<0||!S_ISREG(s.st_mode)||s.st_size<=0)
+		return;
+	if((size_t)s.st_size!=s.st_size)  /* too big for address space */
+		return;
+	p=mmap(NULL,(size_t)s.st_size,PROT_READ,MAP_PRIVATE,tapefd,0);
+	if(p==MAP_FAILED) return;
+#ifdef MADV_SEQUENTIAL
+	madvise(p,(size_t)s.st_size,MADV_SEQUENTIAL);
+#endif
+	tapemap=p;
+	tapemaplen=s.st_size;
+}
+
 /* close the tape drive */
 void closetape()
 {
 	if(waccess) {			/* opened for create/append */
 		tapemark();		/* add one more tape mark */
 					/* (should have one already) */
+		imgflush();		/* write out anything still buffered */
+		if(tapezip) zimgend();	/* and anything being compressed */
 	}
+	if(tapefile) idxsave(tapefd);	/* update index if we made one */
 	if(tapesock) {
 		sendcode(TS_CLS);	/* orderly disconnect */
 		getrc();
@@ -274,6 +390,10 @@ void closetape()
 			exit(1);
 		}
 	}
+	if(tapemap) {
+		munmap(tapemap,tapemaplen);
+		tapemap=NULL;
+	}
 	if(close(tapefd)<0) {
 		perror("?Error closing tape");
 		exit(1);
@@ -283,13 +403,17 @@ void closetape()
 /* rewind tape */
 void posnbot()
 {
+	nrecs=0;			/* (for 7-track parity messages) */
 	if(tapesock) {			/* MTS tape server */
 		sendcode(TS_REW);	/* cmd=$CONTROL *TAPE* REW */
 		getrc();		/* check return code */
 	}
+	else if(tapemap) tapepos=0;	/* mapped image file */
 	else if(tapefile) {		/* image file */
-		if(lseek(tapefd,0L,SEEK_SET)<0) {
-			perror("?Seek failed");
+		imgflush();
+		if(!tapestream) imgseek(0);
+		else if(tapepos!=0) {	/* fine if we haven't moved yet */
+			fprintf(stderr,"?Can't rewind a pipe\n");
 			exit(1);
 		}
 	}
@@ -309,7 +433,18 @@ void posneot()
 		getrc();		/* check return code */
 	}
 	else if(tapefile) {		/* image file */
-		if(lseek(tapefd,-4L,SEEK_END)<0) {
+		long long eot;
+		imgflush();
+		if(tapestream) {
+			fprintf(stderr,"?Can't append to a pipe\n");
+			exit(1);
+		}
+		inptr=inend=0;		/* forget anything read ahead */
+		/* use index if we have one, otherwise assume the image */
+		/* ends with the second of two tape marks */
+		if((eot=idxeot())>=0) tapepos=lseek(tapefd,eot,SEEK_SET);
+		else tapepos=lseek(tapefd,-4L,SEEK_END);
+		if(tapepos<0) {
 			perror("?Seek failed");
 			exit(1);
 		}
@@ -337,13 +472,11 @@ void posneot()
 	}
 }
 
-unsigned long getlen()
+/* compose a 32-bit record length from 4 bytes in image file byte order */
+static unsigned long lenval(unsigned char *byte)
 {
-	unsigned char byte[4];		/* 32 bits for length field(s) */
 	unsigned long l;		/* at least 32 bits */
 
-	doread(tapefd,byte,4);	/* get record length */
-				/* compose into longword */
 	if (big_endian)
 		l=((unsigned long)byte[0]<<24L)|
 		  ((unsigned long)byte[1]<<16L)|
@@ -357,12 +490,162 @@ unsigned long getlen()
 	return l;
 }
 
+/* go to offset POS of an image file (as found in the record index) */
+void tapeseek(long long pos)
+{
+	if(tapemap) {			/* mapped image file */
+		if(pos<0||pos>tapemaplen) {
+			fprintf(stderr,"?Seek past end of tape image\n");
+			exit(1);
+		}
+	}
+	else if(tapefile&&!tapestream) {  /* image file */
+		imgflush();
+		imgseek(pos);
+	}
+	else {
+		fprintf(stderr,"?Can't seek on tape drive or pipe\n");
+		exit(1);
+	}
+	tapepos=pos;
+}
+
+/* go to offset POS of an unmapped image file, forgetting what's buffered */
+static void imgseek(off_t pos)
+{
+	if(pos>=tapepos&&pos-tapepos<=inend-inptr) {  /* already read */
+		inptr+=pos-tapepos;
+		tapepos=pos;
+		return;
+	}
+	inptr=inend=0;
+	if(tapezip) zimgseek(pos);
+	else if(lseek(tapefd,pos,SEEK_SET)<0) {
+		perror("?Seek failed");
+		exit(1);
+	}
+	tapepos=pos;
+}
+
+/* return pointer to the next N bytes of an unmapped image file, reading */
+/* more into inbuf[] if needed (the bytes stay put until the next call) */
+static char *imgget(unsigned long n)
+{
+	unsigned long l;
+	ssize_t k;
+	char *p;
+
+	if(inend-inptr<n) {
+		/* move what's left to the front, and make room for N */
+		memmove(inbuf,inbuf+inptr,inend-inptr);
+		inend-=inptr;
+		inptr=0;
+		if(n>inlen) {
+			l=(n>INBUFLEN)?n:INBUFLEN;
+			if((inbuf=realloc(inbuf,l))==NULL) nomem();
+			inlen=l;
+		}
+		while(inend<n) {
+			if(tapezip) k=zimgget(inbuf+inend,inlen-inend);
+			else if((k=read(tapefd,inbuf+inend,inlen-inend))<0) {
+				perror("?Error on read");
+				exit(1);
+			}
+			if(k==0) {
+				fprintf(stderr,"?Unexpected end of file\n");
+				exit(1);
+			}
+			inend+=k;
+		}
+	}
+	p=inbuf+inptr;
+	inptr+=n;
+	return(p);
+}
+
+/* get record length from mapped image and advance past it */
+static unsigned long maplen()
+{
+	unsigned char *p;
+
+	if(tapemaplen-(size_t)tapepos<4) {
+		fprintf(stderr,"?Unexpected end of file\n");
+		exit(1);
+	}
+	p=(unsigned char *)tapemap+tapepos;
+	tapepos+=4;
+	return lenval(p);
+}
+
+/* return offset in image file of last record read by getrecp(), or -1 */
+long long recoffset()
+{
+	return(recpos);
+}
+
 /* read a tape record, return actual length (0=tape mark) */
+/* *BUFP is set to point at the data, which is either in our own buffer or */
+/* (for a mapped image file) left where it is in the mapping, so don't write */
+/* it.  Image file records may be any length up to the SIMH limit, other */
+/* devices are read with a LEN-byte buffer */
+int getrecp(char **bufp,int len)
+{
+	unsigned long l;
+	off_t pos=tapepos;
+	int n;
+
+	recpos=tapefile?pos:-1;		/* for error messages */
+
+	if(tapemap) {			/* mapped image file */
+		l=maplen();		/* get record length */
+		if(l>MAXRECLEN) toolong(l);
+		if(l!=0) {		/* data unless tape mark */
+			/* data, SIMH pad byte if odd, and trailing length */
+			/* must fit */
+			if(tapemaplen-(size_t)tapepos<l+(simh&&(l&1))+4) {
+				fprintf(stderr,"?Unexpected end of file\n");
+				exit(1);
+			}
+			*bufp=tapemap+tapepos;
+			tapepos+=l;
+			if(simh&&(l&1)) tapepos++;  /* SIMH pads odd records */
+			if(maplen()!=l) {	/* should match */
+				fprintf(stderr,"?Corrupt tape image\n");
+				exit(1);
+			}
+		}
+	}
+	else if(tapefile) {		/* image file, through inbuf[] */
+		imgflush();
+		l=lenval((unsigned char *)imgget(4));
+		if(l>MAXRECLEN) toolong(l);
+		tapepos+=4;
+		if(l!=0) {		/* get data unless tape mark */
+			/* SIMH pads odd records, get pad byte and trailing */
+			/* length with data (in one go so it all stays put) */
+			n=l+(simh&&(l&1));
+			*bufp=imgget(n+4);
+			if(lenval((unsigned char *)*bufp+n)!=l) {
+				fprintf(stderr,"?Corrupt tape image\n");
+				exit(1);
+			}
+			tapepos+=n+4;
+		}
+	}
+	else {				/* everything else, into our buffer */
+		*bufp=rdspace(len);
+		return(getrec(*bufp,len));
+	}
+	idxrec(pos,*bufp,l);
+	return(l);
+}
+
+/* read a tape record from a tape drive or tape server (image files are */
+/* read by getrecp()), return actual length (0=tape mark) */
 int getrec(char *buf,int len)
 {
 	unsigned char byte[4];		/* 32 bits for length field(s) */
 	unsigned long l;		/* at least 32 bits */
-	unsigned char scratch[1];
 	int i;
 
 	if(tapesock) {			/* MTS tape server */
@@ -373,19 +656,6 @@ int getrec(char *buf,int len)
 		if(l>len) goto toolong;	/* don't read if too long for buf */
 		if(l!=0) doread(tapefd,buf,l);  /* get data unless tape mark */
 	}
-	else if(tapefile) {		/* image file */
-		l=getlen();
-		if(l>len) goto toolong;	/* don't read if too long for buf */
-		if(l!=0) {		/* get data unless tape mark */
-			doread(tapefd,buf,l);  /* read data */
-			/* SIMH pads odd records, read scratch byte */
-			if(simh&&(l&1)) doread(tapefd,scratch,1);
-			if(getlen()!=l) {	/* should match */
-				fprintf(stderr,"?Corrupt tape image\n");
-				exit(1);
-			}
-		}
-	}
 	else if(tapermt) {		/* rmt tape server */
 		len=sprintf(netbuf,"R%d\n",len);
 		dowrite(tapefd,netbuf,len);
@@ -410,13 +680,114 @@ toolong:
 	exit(1);
 }
 
+/* make sure rdbuf[] can hold LEN bytes, return it */
+static char *rdspace(unsigned long len)
+{
+	if(len>rdlen) {
+		if((rdbuf=realloc(rdbuf,len))==NULL) nomem();
+		rdlen=len;
+	}
+	return(rdbuf);
+}
+
+/* complain about an impossible record length L in an image file */
+static void toolong(unsigned long l)
+{
+	fprintf(stderr,"?%lu byte tape record is longer than %lu bytes\n",
+		l,MAXRECLEN);
+	exit(1);
+}
+
+/* skip a tape record without reading the data if we can help it */
+/* return its length (0=tape mark), or 1 if the length isn't known */
+int skiprec()
+{
+	unsigned long l;
+	off_t n;
+	char *p;
+
+	if(tapemap) {			/* mapped image file */
+		l=maplen();
+		if(l!=0) {
+			n=l+(simh&&(l&1));  /* SIMH pads odd records */
+			if(tapemaplen-(size_t)tapepos<n+4) {
+				fprintf(stderr,"?Unexpected end of file\n");
+				exit(1);
+			}
+			tapepos+=n;
+			if(maplen()!=l) {
+				fprintf(stderr,"?Corrupt tape image\n");
+				exit(1);
+			}
+		}
+		return(l);
+	}
+	else if(tapefile) {		/* image file */
+		imgflush();
+		l=lenval((unsigned char *)imgget(4));
+		if(l>MAXRECLEN) toolong(l);
+		tapepos+=4;
+		if(l!=0) {
+			n=l+(simh&&(l&1));
+			/* seek past it unless it's already read (or a pipe) */
+			if(!tapestream&&inend-inptr<n+4) {
+				imgseek(tapepos+n);
+				tapepos-=n;	/* (added back below) */
+				p=imgget(4);
+			}
+			else p=imgget(n+4)+n;
+			if(lenval((unsigned char *)p)!=l) {
+				fprintf(stderr,"?Corrupt tape image\n");
+				exit(1);
+			}
+			tapepos+=n+4;
+		}
+		return(l);
+	}
+	else if(tapetape||tapermt) {	/* local/remote tape drive */
+		/* fails on tape mark, which it spaces past */
+		return(doioctl(&mt_fsr)<0?0:1);
+	}
+	else return(getrec(rdspace(0177777),0177777));  /* MTS tape server */
+}
+
+/* space forward past the next tape mark */
+void skipmark()
+{
+	long long pos;
+
+	if(tapesock) {			/* MTS tape server */
+		sendcode(TS_FSF);	/* cmd=forward space file */
+		getrc();		/* check return code */
+	}
+	else if(tapefile) {		/* image file */
+		/* index knows where the mark is, go straight there */
+		if((pos=idxmark(tapepos))>=0) {
+			if(tapemap) tapepos=pos;
+			else if(!tapestream) imgseek(pos);
+			else while(skiprec()!=0) ;
+		}
+		else while(skiprec()!=0) ;  /* space by records */
+	}
+	else {				/* local/remote tape drive */
+		if(doioctl(&mt_fsf)<0) {
+			perror("?Error spacing to tape mark");
+			exit(1);
+		}
+	}
+}
+
 /* write a tape record */
 void putrec(char *buf,int len)
 {
-	unsigned char l[4];
-	static unsigned char zero[1] = { 0 };
+	int n;
+	unsigned char l[4+1+4];
 
 	if(tapesock) {			/* MTS tape server */
+		if(len>0177777) {	/* length must fit in a halfword */
+			fprintf(stderr,"?Record too long for tape server\n");
+			exit(1);
+		}
 		sendcode(len);		/* command code is length */
 		dowrite(tapefd,buf,len);  /* write data */
 		getrc();		/* check return code */
@@ -424,17 +795,19 @@ void putrec(char *buf,int len)
 	else if(tapefile) {		/* image file */
 		l[0]=len&0377;		/* PDP-11 byte order */
 		l[1]=(len>>8)&0377;
-		l[2]=0;			/* our recs are always < 64 KB */
-		l[3]=0;
-		dowrite(tapefd,l,4);	/* write longword length */
-		dowrite(tapefd,buf,len);  /* write data */
+		l[2]=(len>>16)&0377;	/* (-b makes recs >= 64 KB) */
+		l[3]=(len>>24)&0377;
+		idxrec(tapepos,buf,len);
+		imgput(l,4);		/* write longword length */
+		imgput(buf,len);	/* write data */
 		/* SIMH pads odd records */
-		if(simh&&(len&1)) dowrite(tapefd,zero,1);
-					/* add byte if odd */
-		dowrite(tapefd,l,4);	/* write length again */
+		n=4;
+		if(simh&&(len&1)) l[n++]=0;  /* add byte if odd */
+		memcpy(l+n,l,4);	/* length again (for backspacing) */
+		imgput(l+4,n);
+		tapepos+=4+len+n;
 	}
 	else if(tapermt) {		/* rmt tape */
-		int n;
 		n=sprintf(netbuf,"W%d\n",len);
 		dowrite(tapefd,netbuf,n);
 		dowrite(tapefd,buf,len);
@@ -454,7 +827,9 @@ void tapemark()
 		getrc();		/* check return code */
 	}
 	else if(tapefile) {		/* image file */
-		dowrite(tapefd,zero,4);	/* write longword length */
+		idxrec(tapepos,NULL,0);
+		imgput(zero,4);		/* write longword length */
+		tapepos+=4;
 	}
 	else {				/* local/remote tape drive */
 		if(doioctl(&mt_weof)<0) {
@@ -474,6 +849,41 @@ static void dowrite(int handle,char *buf,int len)
 	}
 }
 
+/* add data to image file output buffer, writing it out if full */
+static void imgput(const void *buf,int len)
+{
+	struct iovec iov[2];
+
+	if(tapezip) {			/* zimage.c does its own buffering */
+		zimgput(buf,len);
+		return;
+	}
+	if(len<=IMGBUFLEN-imgcnt) {	/* fits, just buffer it */
+		memcpy(imgbuf+imgcnt,buf,len);
+		imgcnt+=len;
+		return;
+	}
+	/* write buffer and new data together */
+	iov[0].iov_base=imgbuf;
+	iov[0].iov_len=imgcnt;
+	iov[1].iov_base=(void *)buf;
+	iov[1].iov_len=len;
+	if(writev(tapefd,iov,2)!=imgcnt+len) {
+		perror("?Error on write");
+		exit(1);
+	}
+	imgcnt=0;
+}
+
+/* write out whatever is waiting in the image file output buffer */
+static void imgflush()
+{
+	if(imgcnt) {
+		dowrite(tapefd,imgbuf,imgcnt);
+		imgcnt=0;
+	}
+}
+
 /* do a read and keep trying until we get all bytes */
 static void doread(int handle,char *buf,int len)
 {
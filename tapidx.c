@@ -0,0 +1,417 @@
+/*
+
+  Maintain the record index for a tape image file.
+
+  The index is built as a side effect of writing an image (-c, or -r if the
+  image already had a valid index), or by reading through an existing image
+  once (-i).  Every record and tape mark is passed to idxrec(), which notes
+  its position and picks the volume header and file labels out of the data,
+  so the same code handles all three cases.
+
+  The index file is binary, with all numbers stored least significant byte
+  first regardless of the host's byte order:
+
+	.blkb	8	;magic "TAPIDX02"
+	.long	flags	;1=SIMH padding, 2=big endian lengths, 4=7-track
+	.quad	size	;size of image file when index was written
+	.quad	mtime	;modification time of image file (ns since 1970)
+	.quad	nrecs	;# records and tape marks
+	.quad	nfiles	;# files
+	.long	vollen	;# volume header words
+	.quad	vol[4]	;volume header words
+	then nrecs of:
+	.quad	pos	;byte offset of record
+	.long	len	;record length (0=tape mark)
+	then nfiles of:
+	.quad	rec	;record # containing label
+	.quad	mark	;record # of tape mark ending file
+	.long	off	;word offset of label within record
+	.long	lablen	;# label words
+	.quad	label[7] ;label words (36 bits each)
+	.quad	link[3]	;link target words
+	.quad	words	;# words in file after label
+
+  An index is only believed if the size, date (to the nanosecond, as far
+  as the file system keeps it) and flags all still match the image file,
+  so an image that was rewritten without updating its index is simply
+  treated as unindexed.
+
+  Entry points:
+  idxopen, idxstart, idxrec, idxeot, idxmark, idxsave.
+
+  This file is part of itstar.
+
+  itstar is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  itstar is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with itstar.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "itstar.h"
+#include "tapidx.h"
+
+#ifdef __APPLE__
+#define st_mtim st_mtimespec
+#endif
+
+#define MAGIC "TAPIDX02"
+#define HDRLEN (8+4+8+8+8+8+4+4*8)
+#define RECLEN (8+4)
+#define FILELEN (8+8+4+4+7*8+3*8+8)
+
+void nomem();
+
+extern int simh, big_endian, seven_track;
+
+static void store(struct idxfile *, char *, int, int), grow(void **, unsigned long *, unsigned long, int);
+static void put32(FILE *, unsigned long), put64(FILE *, uint64_t);
+static unsigned long get32(unsigned char *);
+static uint64_t get64(unsigned char *);
+static int idxload(int fd);
+static void newidx(), idxfail();
+static int flags();
+static uint64_t mtime(struct stat *);
+
+int idxvalid=0;			/* NZ => index matches image file */
+struct idxrec *idxrecs=NULL;	/* all records and tape marks */
+unsigned long nidxrecs=0;
+struct idxfile *idxfiles=NULL;	/* all files */
+unsigned long nidxfiles=0;
+uint64_t idxvol[4];		/* volume header words */
+int idxvollen=0;		/* # words stored in idxvol[] */
+
+static unsigned long maxrecs=0, maxfiles=0;  /* allocated sizes */
+static char *idxname=NULL;	/* index filename, NULL if not an image */
+static int idxing=0;		/* NZ => collecting index as we go */
+static int idxasked=0;		/* NZ => -i asked for it, so say if it fails */
+static int gotvol;		/* NZ => volume header has been seen */
+static long curfile;		/* idxfiles[] entry being read, -1 if none */
+
+/* note image file NAME open on FD, load its index if there is one */
+/* "create" and "writable" are as passed to opentape() */
+void idxopen(char *name,int fd,int create,int writable)
+{
+	char *dir, *base;
+
+	/* get the full name now, since -C may change directory before */
+	/* idxsave() writes it */
+	if((base=strrchr(name,'/'))!=NULL) {
+		if((dir=strdup(name))==NULL) nomem();
+		dir[base-name+(base==name)]='\0';  /* (keep "/" if it's all) */
+		base++;
+	}
+	else {
+		if((dir=strdup("."))==NULL) nomem();
+		base=name;
+	}
+	if((idxname=realpath(dir,NULL))==NULL) {
+		perror(dir);
+		exit(1);
+	}
+	free(dir);
+	if((idxname=realloc(idxname,strlen(idxname)+1+strlen(base)+
+		sizeof(IDXEXT)))==NULL) nomem();
+	sprintf(idxname+strlen(idxname),"/%s%s",base,IDXEXT);
+
+	if(create) newidx();		/* new tape, new index */
+	else if(idxload(fd)==0&&writable)
+		idxing=1;		/* extend index as we append */
+}
+
+/* start a new index from scratch, starting at BOT, for -i */
+void idxstart()
+{
+	if(idxname==NULL) {
+		fprintf(stderr,"?Only image files can be indexed\n");
+		exit(1);
+	}
+	idxasked=1;
+	newidx();
+}
+
+/* start a new (empty) index */
+static void newidx()
+{
+	nidxrecs=nidxfiles=0;
+	idxvollen=0;
+	idxvalid=0;
+	gotvol=0;
+	curfile=-1;
+	idxing=1;
+}
+
+/* note a record (or tape mark if LEN=0) at offset POS in image file */
+void idxrec(uint64_t pos,char *buf,int len)
+{
+	struct idxfile *f;
+	int off, n;
+
+	if(!idxing) return;
+	grow((void **)&idxrecs,&maxrecs,nidxrecs,sizeof(struct idxrec));
+	idxrecs[nidxrecs].pos=pos;
+	idxrecs[nidxrecs].len=len;
+
+	if(len==0) {			/* tape mark ends current file */
+		if(curfile>=0) idxfiles[curfile].mark=nidxrecs;
+		curfile=(-1);
+	}
+	else if(curfile>=0)		/* more data for current file */
+		idxfiles[curfile].words+=recwords(len);
+	else {				/* file label, maybe after vol hdr */
+		n=recwords(len);
+		off=0;
+		if(!gotvol) {		/* first record on tape */
+			/* 1: AOBJN ptr giving length */
+			idxvollen=01000000L-(recword(buf,0)>>18);
+			if(idxvollen>n) idxvollen=n;
+			if(idxvollen>4) idxvollen=4;
+			for(;off<idxvollen;off++)
+				idxvol[off]=recword(buf,off);
+			/* skip unknown vol hdr words too */
+			off=01000000L-(recword(buf,0)>>18);
+			gotvol=1;
+		}
+		if(off<n) {
+			grow((void **)&idxfiles,&maxfiles,nidxfiles,
+				sizeof(struct idxfile));
+			f=idxfiles+nidxfiles;
+			f->rec=nidxrecs;
+			f->mark=0;
+			f->off=off;
+			store(f,buf,off,n);
+			curfile=nidxfiles++;
+		}
+	}
+	nidxrecs++;
+}
+
+/* fill in label words etc. of file F, whose label starts at word OFF */
+/* of N-word record BUF */
+static void store(struct idxfile *f,char *buf,int off,int n)
+{
+	int i, len;
+
+	len=01000000L-(recword(buf,off)>>18);  /* AOBJN ptr giving length */
+	if(len>n-off) len=n-off;	/* can't be longer than record */
+	f->lablen=(len>7)?7:len;
+	for(i=0;i<f->lablen;i++)
+		f->label[i]=recword(buf,off+i);
+	memset(f->link,0,sizeof(f->link));
+	if(f->lablen>4&&(f->label[4]>>18)!=0)  /* link, get target */
+		for(i=0;i<3&&off+len+i<n;i++)
+			f->link[i]=recword(buf,off+len+i);
+	f->words=n-off-len;		/* rest of record is data */
+}
+
+/* return offset of logical EOT (the second of the two tape marks at the */
+/* end of the tape), or -1 if unknown */
+/* the tape mark is dropped from the index since it will be overwritten */
+long long idxeot()
+{
+	if(!idxvalid||nidxrecs==0||idxrecs[nidxrecs-1].len!=0) return(-1);
+	curfile=(-1);			/* between files */
+	gotvol=1;
+	return(idxrecs[--nidxrecs].pos);
+}
+
+/* return offset just past the first tape mark at or after offset POS, */
+/* or -1 if unknown */
+long long idxmark(uint64_t pos)
+{
+	unsigned long lo, hi, mid;
+
+	if(!idxvalid) return(-1);
+	for(lo=0,hi=nidxrecs;lo<hi;) {	/* find first record at/after POS */
+		mid=(lo+hi)/2;
+		if(idxrecs[mid].pos<pos) lo=mid+1;
+		else hi=mid;
+	}
+	for(;lo<nidxrecs;lo++)		/* then look for tape mark */
+		if(idxrecs[lo].len==0) return(idxrecs[lo].pos+4);
+	return(-1);
+}
+
+/* write out the index for the image file open on FD */
+/* (the image is fine without it, so failing just means there's no index) */
+void idxsave(int fd)
+{
+	FILE *f;
+	struct stat s;
+	struct idxfile *p;
+	unsigned long i;
+	int j;
+
+	if(!idxing) return;
+	if(fstat(fd,&s)<0||(f=fopen(idxname,"wb"))==NULL) {
+		idxfail();
+		return;
+	}
+	fwrite(MAGIC,1,8,f);
+	put32(f,flags());
+	put64(f,s.st_size);
+	put64(f,mtime(&s));
+	put64(f,nidxrecs);
+	put64(f,nidxfiles);
+	put32(f,idxvollen);
+	for(j=0;j<4;j++) put64(f,j<idxvollen?idxvol[j]:0);
+	for(i=0;i<nidxrecs;i++) {
+		put64(f,idxrecs[i].pos);
+		put32(f,idxrecs[i].len);
+	}
+	for(i=0,p=idxfiles;i<nidxfiles;i++,p++) {
+		put64(f,p->rec);
+		put64(f,p->mark);
+		put32(f,p->off);
+		put32(f,p->lablen);
+		for(j=0;j<7;j++) put64(f,j<p->lablen?p->label[j]:0);
+		for(j=0;j<3;j++) put64(f,p->link[j]);
+		put64(f,p->words);
+	}
+	if(ferror(f)|(fclose(f)==EOF)) {
+		idxfail();
+		unlink(idxname);	/* (don't leave half of one) */
+	}
+}
+
+/* the index couldn't be written, say so if it was asked for with -i, */
+/* otherwise the tape just doesn't get one */
+static void idxfail()
+{
+	if(idxasked)
+		fprintf(stderr,"WARNING: can't write index %s:  %s\n",
+			idxname,strerror(errno));
+}
+
+/* load index for image file open on FD, return 0 if OK or -1 if none */
+static int idxload(int fd)
+{
+	FILE *f;
+	struct stat s, si;
+	struct idxfile *p;
+	unsigned char *buf, *q;
+	unsigned long i;
+	uint64_t nr, nf, n;
+	int j;
+
+	if(fstat(fd,&s)<0) return(-1);
+	if((f=fopen(idxname,"rb"))==NULL) return(-1);
+	if(fstat(fileno(f),&si)<0||si.st_size<HDRLEN) {
+		fclose(f);
+		return(-1);
+	}
+	if((buf=malloc(si.st_size))==NULL) nomem();
+	if(fread(buf,1,si.st_size,f)!=si.st_size) {
+		fclose(f);
+		free(buf);
+		return(-1);
+	}
+	fclose(f);
+
+	/* make sure it's for this image, as it is now */
+	if(memcmp(buf,MAGIC,8)!=0||get32(buf+8)!=flags()||
+		get64(buf+12)!=s.st_size||get64(buf+20)!=mtime(&s)) {
+		free(buf);
+		return(-1);
+	}
+	/* (checked a step at a time, so huge counts can't overflow) */
+	nr=get64(buf+28);
+	nf=get64(buf+36);
+	n=si.st_size-HDRLEN;		/* bytes after header */
+	if(nr>n/RECLEN||nf>(n-nr*RECLEN)/FILELEN||
+		n!=nr*RECLEN+nf*FILELEN) {
+		free(buf);		/* truncated or something */
+		return(-1);
+	}
+	nidxrecs=nr;
+	nidxfiles=nf;
+	idxvollen=get32(buf+44);
+	for(j=0;j<4;j++) idxvol[j]=get64(buf+48+j*8);
+
+	maxrecs=nidxrecs+1;
+	if((idxrecs=malloc(maxrecs*sizeof(struct idxrec)))==NULL) nomem();
+	for(i=0,q=buf+HDRLEN;i<nidxrecs;i++,q+=RECLEN) {
+		idxrecs[i].pos=get64(q);
+		idxrecs[i].len=get32(q+8);
+	}
+	maxfiles=nidxfiles+1;
+	if((idxfiles=malloc(maxfiles*sizeof(struct idxfile)))==NULL) nomem();
+	for(i=0,p=idxfiles;i<nidxfiles;i++,p++,q+=FILELEN) {
+		p->rec=get64(q);
+		p->mark=get64(q+8);
+		p->off=get32(q+16);
+		p->lablen=get32(q+20);
+		for(j=0;j<7;j++) p->label[j]=get64(q+24+j*8);
+		for(j=0;j<3;j++) p->link[j]=get64(q+80+j*8);
+		p->words=get64(q+104);
+	}
+	free(buf);
+	gotvol=1;
+	curfile=(-1);
+	idxvalid=1;
+	return(0);
+}
+
+/* return flags word describing the current image format */
+static int flags()
+{
+	return((simh?1:0)|(big_endian?2:0)|(seven_track?4:0));
+}
+
+/* return the modification time in stat buffer S, in ns since 1970 */
+static uint64_t mtime(struct stat *s)
+{
+	return((uint64_t)s->st_mtim.tv_sec*1000000000+s->st_mtim.tv_nsec);
+}
+
+/* make sure there's room for entry N in array *P of *MAX entries of SIZE */
+static void grow(void **p,unsigned long *max,unsigned long n,int size)
+{
+	if(n<*max) return;
+	*max=(*max)?(*max)*2:1024;
+	if((*p=realloc(*p,(*max)*size))==NULL) nomem();
+}
+
+/* write a longword, LSB first */
+static void put32(FILE *f,unsigned long n)
+{
+	int i;
+	for(i=0;i<4;i++,n>>=8) putc(n&0377,f);
+}
+
+/* write a quadword, LSB first */
+static void put64(FILE *f,uint64_t n)
+{
+	int i;
+	for(i=0;i<8;i++,n>>=8) putc(n&0377,f);
+}
+
+/* read a longword, LSB first */
+static unsigned long get32(unsigned char *p)
+{
+	return(((unsigned long)p[3]<<24)|((unsigned long)p[2]<<16)|
+		((unsigned long)p[1]<<8)|p[0]);
+}
+
+/* read a quadword, LSB first */
+static uint64_t get64(unsigned char *p)
+{
+	return(((uint64_t)get32(p+4)<<32)|get32(p));
+}
@@ -0,0 +1,57 @@
+/*
+
+  Record index for tape image files.
+
+  The index lives alongside an image file (same name plus ".tapidx") and
+  records where every record and tape mark starts, plus the label words of
+  every file on the tape, so that questions about what's on the tape can be
+  answered (and individual files found) without reading the whole image.
+
+  This file is part of itstar.
+
+  itstar is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  itstar is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with itstar.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#define IDXEXT ".tapidx"	/* added to image filename */
+
+struct idxrec {			/* one per record or tape mark */
+	uint64_t pos;		/* byte offset of record in image */
+	unsigned long len;	/* record length, 0 => tape mark */
+};
+
+struct idxfile {		/* one per file on tape */
+	unsigned long rec;	/* index in idxrecs[] of record with label */
+	unsigned long mark;	/* index in idxrecs[] of tape mark after file */
+	int off;		/* word offset of label within its record */
+	int lablen;		/* # label words stored in label[] */
+	uint64_t label[7];	/* AOBJN, UFD, FN1, FN2, LINKF, CDATE, RDATE */
+	uint64_t link[3];	/* FN1, FN2, UFD of link target (if a link) */
+	unsigned long words;	/* # words following label in the file */
+};
+
+extern int idxvalid;		/* NZ => index matches image file */
+extern struct idxrec *idxrecs;
+extern unsigned long nidxrecs;
+extern struct idxfile *idxfiles;
+extern unsigned long nidxfiles;
+extern uint64_t idxvol[4];	/* volume header words */
+extern int idxvollen;		/* # words stored in idxvol[] */
+
+void idxopen(char *name,int fd,int create,int writable);
+void idxstart();
+void idxrec(uint64_t pos,char *buf,int len);
+long long idxeot();
+long long idxmark(uint64_t pos);
+void idxsave(int fd);
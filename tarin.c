@@ -0,0 +1,494 @@
+/*
+
+  Read a tar or cpio archive of files to save, for -I.
+
+  The archive (which may be compressed, or "-" for STDIN) is read straight
+  through once, and each member is saved as it's found, just as if it had
+  been unpacked to disk and named on the command line:  the ITS name comes
+  from the member's name by the usual rules, its modification and access
+  times are the creation and reference dates, symbolic links (and hard
+  links) become ITS links, and the contents are read from memory, being
+  uncompressed first if the name ends in ".Z" or ".gz" (and otherwise
+  saved byte for byte, even if they start like a compressed file).
+  Directories are skipped, and so are devices, FIFOs etc. (with a
+  warning).
+
+  Formats understood are POSIX ustar (with pax extended headers for long
+  names and exact sizes and dates), GNU tar (with long names, and access
+  times if it has them), old V7 tar, and cpio in "newc" (SVR4, with or
+  without CRC) and "odc" (POSIX.1 portable ASCII) formats.
+
+  In newc archives only one member of a set of hard links (normally the
+  last) carries the data, and the others are empty.  They're held back
+  until the one with the data has been saved, and then saved as ITS links
+  to it, the same as tar hard links.
+
+  Entry points:
+  tarin, addarchive.
+
+  This file is part of itstar.
+
+  itstar is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  itstar is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with itstar.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "itstar.h"
+
+void nomem();
+
+#define TBLOCK 512		/* tar block size */
+
+/* cpio mode bits */
+#define C_IFMT 0170000
+#define C_IFDIR 0040000
+#define C_IFREG 0100000
+#define C_IFLNK 0120000
+
+static FILE *af=NULL;		/* the archive */
+static char *aname;		/* its name, for error messages */
+static long long apos;		/* offset of next byte in archive */
+
+/* tar:  what long name and pax headers said about the next member */
+static char *lname=NULL, *llink=NULL;  /* name, link target if not NULL */
+static long long psize=-1;	/* size if >=0 */
+static time_t pmtime=0, patime=0;  /* dates if NZ */
+
+/* newc:  sets of hard links seen so far, hash table keyed on dev/inode */
+struct waiting {		/* member held back until the data turns up */
+	char *name;		/* its name */
+	time_t mtime;		/* its date */
+	struct waiting *next;	/* next one, in archive order */
+};
+struct hlink {			/* one set of hard links */
+	unsigned long long dev;	/* device (major<<32|minor) */
+	unsigned long long ino;	/* inode # */
+	char *name;		/* member that had the data, NULL if not yet */
+	struct waiting *wait;	/* members waiting for it */
+};
+static struct hlink **links=NULL;
+static unsigned long nlinks=0, maxlinks=0;
+
+static void tarfiles(char *), cpiofiles(int), pax(char *, long long),
+	member(char *, time_t, time_t, char *, long long),
+	hardlink(char *, time_t, unsigned long long, unsigned long long,
+	long long), endlinks(), aread(char *, size_t), askip(long long),
+	punt(char *);
+static struct hlink *findlink(unsigned long long, unsigned long long);
+static unsigned long linkhash(unsigned long long, unsigned long long);
+static char *body(long long);
+static long long number(char *, int, int);
+
+/* open archive NAME ("-" for STDIN) for addarchive() */
+/* (done before -C changes directory, so NAME is where the user thinks) */
+void tarin(char *name)
+{
+	aname=name;
+	if(strcmp(name,"-")==0) af=zstream(stdin,"STDIN");
+	else if((af=fopen(name,"rb"))==NULL) {
+		perror(name);
+		exit(1);
+	}
+	else af=zstream(af,name);	/* (whatever it's called) */
+}
+
+/* save all files in the archive, if there is one */
+/* output buffer must have been initialized with resetbuf() */
+void addarchive()
+{
+	char magic[6];
+
+	if(af==NULL) return;
+	apos=0;
+	aread(magic,6);			/* see what we have */
+	if(memcmp(magic,"070701",6)==0||memcmp(magic,"070702",6)==0)
+		cpiofiles(1);		/* newc */
+	else if(memcmp(magic,"070707",6)==0)
+		cpiofiles(0);		/* odc */
+	else tarfiles(magic);
+	if(af!=stdin) fclose(af);
+	af=NULL;
+}
+
+/* save the files in a tar archive, whose first 6 bytes are in MAGIC */
+static void tarfiles(char *magic)
+{
+	char h[TBLOCK];
+	char *n, *l;
+	long long size;
+	time_t mtime, atime;
+	unsigned long sum, chk;
+	int i, ustar, gnu;
+
+	memcpy(h,magic,6);
+	for(i=6;;i=0) {
+		aread(h+i,TBLOCK-i);
+		for(i=0;i<TBLOCK&&h[i]==0;i++) ;
+		if(i==TBLOCK) break;	/* zero block marks the end */
+
+		/* check the header */
+		for(sum=0,i=0;i<TBLOCK;i++)
+			sum+=(i>=148&&i<156)?' ':(unsigned char)h[i];
+		chk=number(h+148,8,8);
+		if(sum!=chk) punt("bad header checksum");
+		ustar=memcmp(h+257,"ustar",5)==0;
+		gnu=memcmp(h+257,"ustar  ",8)==0;  /* (old GNU format) */
+
+		size=number(h+124,12,8);
+		if(psize>=0) size=psize;
+		mtime=pmtime?pmtime:number(h+136,12,8);
+		atime=patime?patime:(gnu&&h[345]?number(h+345,12,8):mtime);
+
+		if(h[156]=='L'||h[156]=='K'||h[156]=='x'||h[156]=='g') {
+			n=body(size);	/* header for next member */
+			askip((TBLOCK-size%TBLOCK)%TBLOCK);
+			switch(h[156]) {
+			case 'L':	/* GNU long name */
+				free(lname);
+				lname=n;
+				break;
+			case 'K':	/* GNU long link target */
+				free(llink);
+				llink=n;
+				break;
+			case 'x':	/* pax header */
+				pax(n,size);
+				free(n);
+				break;
+			default:	/* global pax header, ignore it */
+				free(n);
+			}
+			continue;
+		}
+
+		/* get full names (fields may fill without a NUL) */
+		if(lname) n=lname;
+		else {
+			if((n=malloc(155+1+100+1))==NULL) nomem();
+			if(ustar&&!gnu&&h[345])
+				sprintf(n,"%.155s/%.100s",h+345,h);
+			else sprintf(n,"%.100s",h);
+		}
+		if(llink) l=llink;
+		else {
+			if((l=malloc(100+1))==NULL) nomem();
+			sprintf(l,"%.100s",h+157);
+		}
+
+		switch(h[156]) {
+		case '0':		/* file */
+		case '\0':
+		case '7':
+			if(n[0]&&n[strlen(n)-1]=='/') {  /* V7 directory */
+				askip(size);
+				break;
+			}
+			member(n,mtime,atime,NULL,size);
+			break;
+		case '1':		/* hard link */
+		case '2':		/* symbolic link */
+			member(n,mtime,atime,l,0);
+			askip(size);
+			break;
+		case '5':		/* directory */
+			askip(size);
+			break;
+		default:
+			fprintf(stderr,"WARNING: %s isn't a file, skipped\n",n);
+			askip(size);
+		}
+		askip((TBLOCK-size%TBLOCK)%TBLOCK);
+
+		free(n), free(l);
+		lname=llink=NULL;
+		psize=-1, pmtime=patime=0;
+	}
+}
+
+/* parse pax header at P (LEN bytes), for the things we care about */
+/* each record is "LEN KEY=VALUE\n", where LEN includes everything */
+static void pax(char *p,long long len)
+{
+	char *e, *k, *v;
+	long long n;
+
+	for(e=p+len;p<e;p+=n) {
+		n=strtoll(p,&k,10);
+		if(n<=0||n>e-p||*k!=' '||p[n-1]!='\n') punt("bad pax header");
+		p[n-1]='\0';
+		k++;
+		if((v=strchr(k,'='))==NULL) punt("bad pax header");
+		*v++='\0';
+		if(strcmp(k,"path")==0) {
+			free(lname);
+			if((lname=strdup(v))==NULL) nomem();
+		}
+		else if(strcmp(k,"linkpath")==0) {
+			free(llink);
+			if((llink=strdup(v))==NULL) nomem();
+		}
+		else if(strcmp(k,"size")==0) psize=strtoll(v,NULL,10);
+		else if(strcmp(k,"mtime")==0) pmtime=strtoll(v,NULL,10);
+		else if(strcmp(k,"atime")==0) patime=strtoll(v,NULL,10);
+	}
+}
+
+/* save the files in a cpio archive, in newc format if NEWC is NZ or */
+/* else odc, whose 6-byte magic number has already been read */
+static void cpiofiles(int newc)
+{
+	char h[110];
+	char *n, *l;
+	long long size, namesize;
+	unsigned long long ino=0, dev=0;
+	unsigned long mode, nlink=1;
+	time_t mtime;
+	int hlen=newc?110:76;
+
+	for(;;) {
+		aread(h+6,hlen-6);	/* rest of header */
+		if(newc) {
+			ino=number(h+6,8,16);
+			mode=number(h+14,8,16);
+			nlink=number(h+38,8,16);
+			mtime=number(h+46,8,16);
+			size=number(h+54,8,16);
+			dev=(number(h+62,8,16)<<32)|number(h+70,8,16);
+			namesize=number(h+94,8,16);
+		}
+		else {
+			mode=number(h+18,6,8);
+			mtime=number(h+48,11,8);
+			namesize=number(h+59,6,8);
+			size=number(h+65,11,8);
+		}
+		if(namesize<=0) punt("bad name length");
+		n=body(namesize);
+		if(newc) askip((4-(hlen+namesize)%4)%4);
+		n[namesize-1]='\0';
+		if(strcmp(n,"TRAILER!!!")==0) {
+			free(n);
+			endlinks();
+			break;
+		}
+
+		switch(mode&C_IFMT) {
+		case C_IFREG:
+			if(newc&&nlink>1) hardlink(n,mtime,dev,ino,size);
+			else member(n,mtime,mtime,NULL,size);
+			break;
+		case C_IFLNK:
+			l=body(size);	/* (NUL added by body()) */
+			member(n,mtime,mtime,l,0);
+			free(l);
+			break;
+		case C_IFDIR:
+			askip(size);
+			break;
+		default:
+			fprintf(stderr,"WARNING: %s isn't a file, skipped\n",n);
+			askip(size);
+		}
+		if(newc) askip((4-size%4)%4);
+		free(n);
+
+		aread(h,6);		/* next header */
+		if(memcmp(h,newc?"0707":"070707",newc?4:6)!=0)
+			punt("bad cpio header");
+	}
+}
+
+/* save member N with dates MTIME and ATIME, which is a link to L if that's */
+/* not NULL or else a file whose SIZE bytes come next in the archive */
+static void member(char *n,time_t mtime,time_t atime,char *l,long long size)
+{
+	if(l) addmember(n,mtime,atime,l,NULL);
+	else addmember(n,mtime,atime,NULL,zmemopen(body(size),size,n));
+}
+
+/* save newc member N (dated MTIME, SIZE bytes), which is one of a set of */
+/* hard links to inode INO on device DEV */
+/* the ones with no data wait until the one with the data has been saved */
+static void hardlink(char *n,time_t mtime,unsigned long long dev,
+	unsigned long long ino,long long size)
+{
+	struct hlink *k=findlink(dev,ino);
+	struct waiting *w, **p;
+
+	if(size==0&&k->name) {		/* data's already saved, link to it */
+		member(n,mtime,mtime,k->name,0);
+		return;
+	}
+	if(size==0) {			/* wait for the data */
+		if((w=malloc(sizeof(struct waiting)))==NULL) nomem();
+		if((w->name=strdup(n))==NULL) nomem();
+		w->mtime=mtime;
+		w->next=NULL;
+		for(p=&k->wait;*p;p=&(*p)->next) ;
+		*p=w;
+		return;
+	}
+	member(n,mtime,mtime,NULL,size);
+	if(k->name) return;		/* (data again, it's just a file) */
+	if((k->name=strdup(n))==NULL) nomem();
+	while((w=k->wait)!=NULL) {	/* the rest link to it */
+		member(w->name,w->mtime,w->mtime,k->name,0);
+		k->wait=w->next;
+		free(w->name), free(w);
+	}
+}
+
+/* at the end of a newc archive, save any hard links still waiting (files */
+/* that really are empty) as an empty file and links to it, and forget */
+/* all the sets */
+static void endlinks()
+{
+	struct hlink *k;
+	struct waiting *w;
+	unsigned long i;
+
+	for(i=0;i<maxlinks;i++) {
+		if((k=links[i])==NULL) continue;
+		while((w=k->wait)!=NULL) {
+			member(w->name,w->mtime,w->mtime,k->name,0);
+			if(k->name==NULL) k->name=w->name;
+			else free(w->name);
+			k->wait=w->next;
+			free(w);
+		}
+		free(k->name), free(k);
+	}
+	free(links);
+	links=NULL;
+	nlinks=maxlinks=0;
+}
+
+/* return the set of hard links to inode INO on device DEV, adding it if */
+/* it's new */
+static struct hlink *findlink(unsigned long long dev,unsigned long long ino)
+{
+	struct hlink **old, *k;
+	unsigned long i, j, n;
+
+	if(maxlinks)
+		for(i=linkhash(dev,ino)&(maxlinks-1);(k=links[i]);
+			i=(i+1)&(maxlinks-1))
+			if(k->dev==dev&&k->ino==ino) return(k);
+
+	if(2*(nlinks+1)>maxlinks) {	/* keep it at most half full */
+		old=links;
+		n=maxlinks;
+		maxlinks=maxlinks?maxlinks*2:256;
+		if((links=calloc(maxlinks,sizeof(struct hlink *)))==NULL)
+			nomem();
+		for(i=0;i<n;i++) if(old[i]) {
+			for(j=linkhash(old[i]->dev,old[i]->ino)&(maxlinks-1);
+				links[j];j=(j+1)&(maxlinks-1)) ;
+			links[j]=old[i];
+		}
+		free(old);
+	}
+	for(i=linkhash(dev,ino)&(maxlinks-1);links[i];i=(i+1)&(maxlinks-1)) ;
+	if((k=links[i]=malloc(sizeof(struct hlink)))==NULL) nomem();
+	k->dev=dev, k->ino=ino;
+	k->name=NULL;
+	k->wait=NULL;
+	nlinks++;
+	return(k);
+}
+
+/* hash of DEV and INO for findlink() */
+static unsigned long linkhash(unsigned long long dev,unsigned long long ino)
+{
+	uint64_t h=(dev*UINT64_C(1099511628211))^ino;
+
+	return((h*UINT64_C(0x9E3779B97F4A7C15))>>20);
+}
+
+/* read the next N bytes of the archive into a buffer (malloc()ed, with a */
+/* NUL after them) */
+static char *body(long long n)
+{
+	char *p;
+
+	if(n<0||(size_t)n!=n||(size_t)n+1==0) punt("bad length");
+	if((p=malloc((size_t)n+1))==NULL) nomem();
+	aread(p,n);
+	p[n]='\0';
+	return(p);
+}
+
+/* read N bytes of the archive into BUF */
+static void aread(char *buf,size_t n)
+{
+	if(fread(buf,1,n,af)!=n) {
+		if(ferror(af)) {
+			perror(aname);
+			exit(1);
+		}
+		punt("unexpected end of archive");
+	}
+	apos+=n;
+}
+
+/* skip N bytes of the archive */
+static void askip(long long n)
+{
+	char buf[TBLOCK];
+	size_t k;
+
+	for(;n>0;n-=k) {
+		k=n<sizeof(buf)?n:sizeof(buf);
+		aread(buf,k);
+	}
+}
+
+/* parse the LEN-char number in base BASE (8 or 16) at P, which may have */
+/* leading spaces and end at a space or NUL (or, for tar, be GNU's base */
+/* 256 if the first byte has the high bit set) */
+static long long number(char *p,int len,int base)
+{
+	long long n=0;
+	int i, c;
+
+	if(base==8&&(*p&0200)) {	/* GNU base 256 */
+		if(*p&0100) punt("negative number");
+		for(n=*p&077,i=1;i<len;i++) n=(n<<8)|(unsigned char)p[i];
+		return(n);
+	}
+	for(i=0;i<len&&p[i]==' ';i++) ;
+	for(;i<len&&p[i]!=' '&&p[i]!='\0';i++) {
+		c=p[i];
+		if(c>='0'&&c<='7') c-='0';
+		else if(base==16&&c>='8'&&c<='9') c-='0';
+		else if(base==16&&c>='a'&&c<='f') c-='a'-10;
+		else if(base==16&&c>='A'&&c<='F') c-='A'-10;
+		else punt("bad number");
+		n=n*base+c;
+	}
+	return(n);
+}
+
+/* report a format error in the archive and quit */
+static void punt(char *msg)
+{
+	fprintf(stderr,"?Format error in %s at byte %lld:  %s\n",aname,apos,
+		msg);
+	exit(1);
+}
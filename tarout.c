@@ -0,0 +1,277 @@
+/*
+
+  Write extracted files to a tar or cpio archive instead of the disk, for -X.
+
+  Each file is packed into memory (in the format chosen with -F) and goes
+  out as soon as it has been read from the tape, under the same name, with
+  the same date and (for links) the same symlink target that -x without -X
+  would have given it on disk.  The directory for each UFD is written just
+  before its first file.  Nothing is created on disk, so there are no
+  mkdir()s, open()s or utime()s, and the archive can go to a pipe.
+
+  The archive is POSIX ustar (which GNU tar, bsdtar etc. all read), or SVR4
+  "newc" cpio with -X cpio,file.  Names written so far are kept in a hash
+  table, so that a name that comes up again is renamed the same way as a
+  file that already exists on disk.
+
+  Entry points:
+  tarout, tarused, tardir, tarfile, tarlink, tarend.
+
+  This file is part of itstar.
+
+  itstar is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  itstar is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with itstar.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "itstar.h"
+
+void nomem();
+
+extern int verify;
+
+#define TBLOCK 512		/* tar block size */
+#define TRECORD (20*TBLOCK)	/* tar pads the archive to this */
+
+static FILE *xf=NULL;		/* the archive, NULL if not -X */
+static char *xname;		/* its name, for error messages */
+static int cpio;		/* NZ => cpio, not tar */
+static unsigned long long xpos;	/* # bytes written so far */
+static unsigned long ino=0;	/* last cpio inode # made up */
+static time_t now;		/* date for directories, and undated files */
+
+static char **names=NULL;	/* hash table of names written so far */
+static unsigned long nnames=0, maxnames=0;
+
+static void header(char *, int, unsigned long, unsigned long long, time_t,
+	char *), xwrite(char *, size_t), xpad(unsigned long), add(char *),
+	octal(char *, int, unsigned long long);
+static unsigned long hash(char *);
+
+/* open the archive for -X SPEC, which is "file", "tar,file" or "cpio,file" */
+/* ("-" is STDOUT) */
+/* (done before -C changes directory, so it's where the user thinks) */
+void tarout(char *spec)
+{
+	if(strncmp(spec,"cpio,",5)==0) cpio=1, spec+=5;
+	else if(strncmp(spec,"tar,",4)==0) cpio=0, spec+=4;
+	else cpio=0;
+	xname=spec;
+	if(strcmp(spec,"-")==0) {
+		if(verify) {	/* (-v output goes there too) */
+			fprintf(stderr,"?-v can't be used with -X to STDOUT\n");
+			exit(1);
+		}
+		xf=stdout;
+	}
+	else if((xf=fopen(spec,"wb"))==NULL) {
+		perror(spec);
+		exit(1);
+	}
+	setvbuf(xf,NULL,_IOFBF,256*1024);
+	xpos=0;
+	now=time(NULL);
+}
+
+/* return NZ if NAME has already been written to the archive */
+int tarused(char *name)
+{
+	unsigned long i;
+
+	if(maxnames==0) return(0);
+	for(i=hash(name)&(maxnames-1);names[i];i=(i+1)&(maxnames-1))
+		if(strcmp(names[i],name)==0) return(1);
+	return(0);
+}
+
+/* write an entry for directory D, unless it's been written already */
+void tardir(char *d)
+{
+	char *p;
+
+	if((p=malloc(strlen(d)+2))==NULL) nomem();
+	sprintf(p,"%s/",d);		/* (so it can't match a file) */
+	if(!tarused(p)) {
+		header(cpio?d:p,'5',0755,0,now,NULL);
+		add(p);
+	}
+	free(p);
+}
+
+/* write file NAME with the LEN bytes at BUF, dated MTIME (0 if undated) */
+void tarfile(char *name,char *buf,size_t len,time_t mtime)
+{
+	header(name,'0',0644,len,mtime?mtime:now,NULL);
+	xwrite(buf,len);
+	xpad(len);
+	add(name);
+}
+
+/* write symlink NAME to TARGET */
+void tarlink(char *name,char *target)
+{
+	header(name,'2',0777,0,now,target);
+	add(name);
+}
+
+/* write the end of the archive, and close it */
+void tarend()
+{
+	static char zero[TBLOCK];
+
+	if(xf==NULL) return;
+	if(cpio) {
+		header("TRAILER!!!",0,0,0,0,NULL);
+		xwrite(zero,(TBLOCK-xpos%TBLOCK)%TBLOCK);
+	}
+	else {
+		xwrite(zero,TBLOCK);	/* two zero blocks */
+		xwrite(zero,TBLOCK);
+		while(xpos%TRECORD) xwrite(zero,TBLOCK);
+	}
+	if(fflush(xf)==EOF||(xf!=stdout&&fclose(xf)==EOF)) {
+		perror(xname);
+		exit(1);
+	}
+	xf=NULL;
+}
+
+/* write the header for NAME, which is a TYPE ('0' file, '2' symlink, */
+/* '5' directory, or 0 for the cpio trailer) with permissions MODE, */
+/* SIZE bytes of data, dated MTIME, with link target LINK (if symlink) */
+/* for a cpio symlink, LINK is written as the data */
+static void header(char *name,int type,unsigned long mode,
+	unsigned long long size,time_t mtime,char *link)
+{
+	char h[TBLOCK+1];
+	unsigned long sum;
+	size_t n;
+	int i;
+
+	if(mtime<0) mtime=0;
+	if(cpio) {
+		if(type=='0') mode|=0100000;
+		else if(type=='2') mode|=0120000, size=strlen(link);
+		else if(type=='5') mode|=0040000;
+		if(size>0xFFFFFFFFUL) {
+			fprintf(stderr,"?File too big for cpio:  %s\n",name);
+			exit(1);
+		}
+		n=strlen(name)+1;
+		sprintf(h,"070701%08lX%08lX%08lX%08lX%08lX%08lX%08lX"
+			"%08lX%08lX%08lX%08lX%08lX%08lX",
+			type?++ino:0,mode,0UL,0UL,type=='5'?2UL:1UL,
+			(unsigned long)mtime,(unsigned long)size,0UL,0UL,0UL,
+			0UL,(unsigned long)n,0UL);
+		xwrite(h,110);
+		xwrite(name,n);
+		xpad(110+n);
+		if(type=='2') {
+			xwrite(link,size);
+			xpad(size);
+		}
+		return;
+	}
+
+	memset(h,0,TBLOCK);
+	if(strlen(name)>100) {		/* (can't happen, they're short) */
+		fprintf(stderr,"?Name too long for tar:  %s\n",name);
+		exit(1);
+	}
+	strncpy(h,name,100);
+	octal(h+100,8,mode);
+	octal(h+108,8,0);		/* uid */
+	octal(h+116,8,0);		/* gid */
+	octal(h+124,12,size);
+	octal(h+136,12,mtime);
+	h[156]=type;
+	if(link) strncpy(h+157,link,100);
+	memcpy(h+257,"ustar\00000",8);	/* magic, version */
+	memset(h+148,' ',8);		/* checksum, counting itself as blanks */
+	for(sum=0,i=0;i<TBLOCK;i++) sum+=(unsigned char)h[i];
+	sprintf(h+148,"%06lo",sum);	/* 6 digits, NUL, space */
+	h[155]=' ';
+	xwrite(h,TBLOCK);
+}
+
+/* write N into the LEN-byte tar field at P, in octal with a NUL after */
+/* it, or in GNU's base 256 if it won't fit */
+static void octal(char *p,int len,unsigned long long n)
+{
+	int i;
+
+	if(n>>(3*(len-1))) {		/* too big */
+		for(i=len-1;i>0;i--,n>>=8) p[i]=n&0377;
+		p[0]=0200;
+		return;
+	}
+	for(p[--len]='\0';len--;n>>=3) p[len]='0'+(n&7);
+}
+
+/* write N bytes from BUF to the archive */
+static void xwrite(char *buf,size_t n)
+{
+	if(n&&fwrite(buf,1,n,xf)!=n) {
+		perror(xname);
+		exit(1);
+	}
+	xpos+=n;
+}
+
+/* pad the archive after something N bytes long */
+static void xpad(unsigned long n)
+{
+	static char zero[TBLOCK];
+	int k=cpio?4:TBLOCK;
+
+	xwrite(zero,(k-n%k)%k);
+}
+
+/* remember that NAME has been written */
+static void add(char *name)
+{
+	char **old;
+	unsigned long i, n;
+
+	if(2*(nnames+1)>maxnames) {	/* keep it at most half full */
+		old=names;
+		n=maxnames;
+		maxnames=maxnames?maxnames*2:1024;
+		if((names=calloc(maxnames,sizeof(char *)))==NULL) nomem();
+		for(i=0;i<n;i++) if(old[i]) {
+			unsigned long j=hash(old[i])&(maxnames-1);
+
+			while(names[j]) j=(j+1)&(maxnames-1);
+			names[j]=old[i];
+		}
+		free(old);
+	}
+	for(i=hash(name)&(maxnames-1);names[i];i=(i+1)&(maxnames-1)) ;
+	if((names[i]=strdup(name))==NULL) nomem();
+	nnames++;
+}
+
+/* FNV-1a hash of NAME */
+static unsigned long hash(char *name)
+{
+	uint64_t h=UINT64_C(14695981039346656037);
+
+	for(;*name;name++) h=(h^(unsigned char)*name)*UINT64_C(1099511628211);
+	return(h);
+}
@@ -0,0 +1,152 @@
+/*
+
+  Make a tree of evacuated-format files for "make test".
+
+  Usage:  gen dir [seed]
+
+  Creates DIR/text, DIR/weird and DIR/mixed, each holding files that are
+  valid input for unpack.c (see FIRST[] and SECOND[] there):  long runs
+  of plain ASCII, runs broken up by 012, 015, 177, the 8-bit codes and
+  ^C's, and quoted binary words (0360-0377 plus 4 bytes, always at a word
+  boundary).  Lengths vary from empty to a few hundred KB so that both
+  the fread() and the mmap()ed input in unpack.c, and every buffer edge
+  in pack.c, get hit.  The same SEED always gives the same files.
+
+  This file is part of itstar.
+
+  itstar is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  itstar is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with itstar.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#define NFILES 150		/* files in each directory */
+#define MAXLEN (300*1024)	/* longest file */
+
+static uint64_t seed;
+static unsigned char *buf;	/* file being made */
+static long len;		/* its length so far */
+static long chars;		/* # 7-bit chars it unpacks to so far */
+
+static unsigned long rnd(unsigned long);
+static void text(long, int), quoted(long), put(int), align(), file(char *,
+	char *, int);
+
+int main(int argc,char **argv)
+{
+	char *d;
+	int i;
+
+	if(argc<2||argc>3) {
+		fprintf(stderr,"Usage:  gen dir [seed]\n");
+		exit(1);
+	}
+	seed=argc>2?strtoull(argv[2],NULL,0):1;
+	seed=seed*2+1;			/* (xorshift mustn't start at 0) */
+	if((buf=malloc(MAXLEN+64))==NULL) {
+		perror("?Error allocating memory");
+		exit(1);
+	}
+	d=argv[1];
+	mkdir(d,0777);
+	for(i=0;i<NFILES;i++) {
+		file(d,"text",i);
+		file(d,"weird",i);
+		file(d,"mixed",i);
+	}
+	return(0);
+}
+
+/* make file #I (with a random length) in directory KIND under D */
+static void file(char *d,char *kind,int i)
+{
+	char name[1024];
+	FILE *f;
+	long n;
+
+	/* mostly short, some past the 64 KB unpack.c reads at a time */
+	n=rnd(8)?rnd(rnd(2)?2000:20000):rnd(MAXLEN);
+	len=chars=0;
+	if(strcmp(kind,"text")==0) text(n,0);
+	else if(strcmp(kind,"weird")==0) text(n,1);
+	else while(len<n) {
+		if(rnd(2)) text(rnd(300),rnd(2));
+		else quoted(1+rnd(40));
+	}
+
+	sprintf(name,"%s/%s",d,kind);
+	mkdir(name,0777);
+	sprintf(name,"%s/%s/f%04d.%d",d,kind,i,(int)rnd(3));
+	if((f=fopen(name,"wb"))==NULL||fwrite(buf,1,len,f)!=len||
+		fclose(f)==EOF) {
+		perror(name);
+		exit(1);
+	}
+}
+
+/* add about N bytes of text, plain ASCII unless WEIRD */
+static void text(long n,int weird)
+{
+	static unsigned char odd[]={ 003, 012, 015, 0177 };
+	unsigned long r;
+
+	for(n+=len;len<n&&len<MAXLEN;) {
+		r=rnd(1000);
+		if(r<40) put(012);	/* newline every so often */
+		else if(r<150) put(' ');
+		else if(weird&&r<200) put(odd[rnd(sizeof(odd))]);
+		else if(weird&&r<260) put(rnd(0360));  /* anything but quotes */
+		else put(' '+1+rnd(0176-' '));
+	}
+}
+
+/* add N quoted binary words */
+static void quoted(long n)
+{
+	align();
+	while(n--&&len<MAXLEN) {	/* (5 chars each, so still aligned) */
+		buf[len++]=0360|rnd(16);
+		buf[len++]=rnd(256), buf[len++]=rnd(256);
+		buf[len++]=rnd(256), buf[len++]=rnd(256);
+	}
+}
+
+/* add byte C (not a quoted word) to the file, counting the 7-bit chars */
+/* it stands for */
+static void put(int c)
+{
+	buf[len++]=c;
+	/* 012 is CRLF, 177 is 177 7, 200-355 are 177 and something */
+	chars+=(c==012||c==0177||(c>=0200&&c<=0355))?2:1;
+}
+
+/* pad with plain chars to a word boundary, where quoted words must start */
+static void align()
+{
+	while(chars%5) put('A'+rnd(26));
+}
+
+/* return a random number from 0 to N-1 (xorshift64) */
+static unsigned long rnd(unsigned long n)
+{
+	seed^=seed<<13;
+	seed^=seed>>7;
+	seed^=seed<<17;
+	return(n?seed%n:0);
+}
@@ -0,0 +1,66 @@
+#!/bin/sh
+#
+# Check pack.c and unpack.c against output from the original itstar, for
+# "make test".
+#
+# test/known/known.tap was written by itstar as it was before the fast
+# paths (and before the word conversions in tm03.c were redone), with
+#
+#	cd test/known
+#	TZ=EST5EDT touch -t 198501021234.56 src/*/*
+#	itstar -c -f known.tap `find src -type f | LC_ALL=C sort`
+#
+# and test/known/out is what that itstar extracted from it.  Every build
+# that packtest.sh makes has to write the same tape (except for today's
+# date in the volume header) and extract the same files.
+#
+# This file is part of itstar.
+#
+# itstar is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# itstar is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with itstar.  If not, see <http://www.gnu.org/licenses/>.
+
+top=`pwd`
+t=test/tmp
+rm -rf $t
+mkdir $t || exit 1
+cp -R test/known/src $t/src || exit 1
+cd $t
+files=`find src -type f | LC_ALL=C sort`
+TZ=EST5EDT touch -t 198501021234.56 $files || exit 1
+
+for b in ref swar fast; do
+	case $b in
+	fast)	bin=$top/itstar ;;
+	*)	bin=$top/test/itstar.$b ;;
+	esac
+	$bin -c -f $b.tap $files || exit 1
+	# (bytes 15-19 are the date the tape was made, word 2 of the volume
+	# header in the first record)
+	if [ `wc -c <$b.tap` -ne `wc -c <$top/test/known/known.tap` ] ||
+		[ -n "`cmp -l $top/test/known/known.tap $b.tap |
+		awk '$1<15||$1>19'`" ]; then
+		echo "?Tape written by $b build differs from known.tap" >&2
+		exit 1
+	fi
+
+	mkdir x.$b
+	(cd x.$b && $bin -x -f $top/test/known/known.tap) || exit 1
+	if ! diff -r $top/test/known/out x.$b >/dev/null; then
+		echo "?Files extracted by $b build differ from test/known/out" >&2
+		exit 1
+	fi
+done
+
+cd $top
+rm -rf $t
+echo "pack/unpack output matches the original itstar"
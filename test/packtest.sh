@@ -0,0 +1,64 @@
+#!/bin/sh
+#
+# Check the fast paths in pack.c and unpack.c against the table-driven
+# code they skip, for "make test".
+#
+# The same generated files (see gen.c) are written to tape by itstar, by
+# test/itstar.swar (built without SSE2, so it uses the 64-bit versions) and
+# by test/itstar.ref (built with -DSCALAR, so it has no fast paths at all).
+# The tapes must be identical, and each build must extract exactly the
+# same files from them.
+#
+# This file is part of itstar.
+#
+# itstar is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# itstar is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with itstar.  If not, see <http://www.gnu.org/licenses/>.
+
+top=`pwd`
+t=test/tmp
+rm -rf $t
+mkdir $t && test/gen $t/src ${SEED:-1} || exit 1
+cd $t
+
+for b in ref swar fast; do
+	case $b in
+	fast)	bin=$top/itstar ;;
+	*)	bin=$top/test/itstar.$b ;;
+	esac
+	$bin -c -f $b.tap src/text src/weird src/mixed || exit 1
+done
+for b in swar fast; do
+	if ! cmp -s ref.tap $b.tap; then
+		echo "?Tape written by $b build differs from reference" >&2
+		exit 1
+	fi
+done
+
+for b in ref swar fast; do
+	case $b in
+	fast)	bin=$top/itstar ;;
+	*)	bin=$top/test/itstar.$b ;;
+	esac
+	mkdir x.$b
+	(cd x.$b && $bin -x -f ../ref.tap) || exit 1
+done
+for b in swar fast; do
+	if ! diff -r x.ref x.$b >/dev/null; then
+		echo "?Files extracted by $b build differ from reference" >&2
+		exit 1
+	fi
+done
+
+cd $top
+rm -rf $t
+echo "pack/unpack fast paths match the reference code"
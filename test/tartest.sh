@@ -0,0 +1,61 @@
+#!/bin/sh
+#
+# Check -I on a tar archive, for "make test".
+#
+# A member whose data merely starts like a compressed file (037 0213 or
+# 037 0235) must be saved byte for byte, while one whose name ends in ".gz"
+# is uncompressed.  The archive itself may be compressed whatever it's
+# called, or come from STDIN, and must give the same tape either way.
+#
+# This file is part of itstar.
+#
+# itstar is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# itstar is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with itstar.  If not, see <http://www.gnu.org/licenses/>.
+
+top=`pwd`
+t=test/tmp
+rm -rf $t
+mkdir $t $t/src $t/src/foo $t/x || exit 1
+cd $t
+
+printf '\037\213junk' >src/foo/gzl.1
+printf '\037\235junk' >src/foo/lzw.1
+printf 'plain text\n' | gzip >src/foo/real.gz
+(cd src && tar cf ../a.tar foo) || exit 1
+gzip -c a.tar >a.tgz
+
+$top/itstar -c -f a.tap -I a.tar || exit 1
+$top/itstar -c -f b.tap -I a.tgz || exit 1
+$top/itstar -c -f c.tap -I - <a.tgz || exit 1
+for b in b c; do
+	if ! cmp -s a.tap $b.tap; then
+		echo "?Tape from compressed archive differs ($b.tap)" >&2
+		exit 1
+	fi
+done
+
+(cd x && $top/itstar -x -f ../a.tap) || exit 1
+for f in gzl.1 lzw.1; do
+	if ! cmp -s src/foo/$f x/foo/$f; then
+		echo "?foo/$f wasn't saved as is" >&2
+		exit 1
+	fi
+done
+if [ "`cat x/foo/real.gz`" != "plain text" ]; then
+	echo "?foo/real.gz wasn't uncompressed" >&2
+	exit 1
+fi
+
+cd $top
+rm -rf $t
+echo "tar members are uncompressed only by name"
@@ -1,6 +1,6 @@
 /*
 
-  Versions of inword() and outword() to convert between 36-bit PDP-10 words and
+  Routines to convert between 36-bit PDP-10 words and
   the 8-bit "core dump" format used by the TM03 formatter found in the TU45,
   TU77 etc.  Also writes 7-track tape images.
 
@@ -13,8 +13,16 @@
   A 7-track tape image stores a 36-bit word as six tape frames with
   six bits in each frame.  There is also a parity bit.
 
+  Words are passed around as the low 36 bits of a uint64_t, and converted
+  a whole array (usually a whole record) at a time.  Each way of storing
+  words on tape is a "codec" with its own conversion loops, and the one for
+  the tape is picked once when it's opened, so nothing here tests which
+  format it is per word (or even per record).  Another format just needs
+  another codec.
+
   Entry points:
-  resetbuf, tapeflush, taperead, inword, outword, remaining.
+  pickcodec, resetbuf, tapeflush, taperead, tapeskip, inwords, skipwords, nextwords,
+  outwords, remaining, recwords, recword, decrec, encrec.
 
   By John Wilson.
 
@@ -37,22 +45,98 @@
 
 */
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "itstar.h"
 
+#if defined(__GNUC__)&&(defined(__x86_64__)||defined(__i386__))
+#define X86SIMD		/* SSSE3/AVX2 versions of TM03 routines */
+#include <immintrin.h>
+#endif
+
 /* AI:SYSDOC;DUMP FORMAT says 1024 */
-#define RECLEN9 (5*1024)
-#define RECLEN7 (6*1024)
-#define RECLEN (seven_track ? RECLEN7 : RECLEN9)
+#define WORDS 1024		/* words per record (times blocking factor) */
+#define MAXRECLEN 0xFFFFFFL	/* SIMH record lengths are 24 bits */
 
 extern int seven_track;
+extern int checkparity;
+extern int blocking;		/* blocking factor, from -b */
+void nomem();
+
+unsigned long parerrs=0;	/* # 7-track records with bad parity */
+unsigned long nrecs=0;		/* # records read by taperead() since BOT */
 
-static char tapebuf[RECLEN7];  /* tape I/O buffer */
+static char *tapebuf=NULL;  /* tape output buffer, reclen bytes */
 static char *tapeptr;	/* ptr to next posn in tapebuf[] */
 static int recl;	/* record length on read */
 
+static void dec5(unsigned char *, uint64_t *, int);
+static void dec6(unsigned char *, uint64_t *, int);
+static void enc5(uint64_t *, unsigned char *, int);
+static void enc6(uint64_t *, unsigned char *, int);
+static void parcheck(unsigned char *, int);
+
+#ifdef X86SIMD
+static void dec5ssse3(unsigned char *, uint64_t *, int);
+static void enc5ssse3(uint64_t *, unsigned char *, int);
+static void dec5avx2(unsigned char *, uint64_t *, int);
+static void enc5avx2(uint64_t *, unsigned char *, int);
+#endif
+
+/* one of these for each way of storing words on tape */
+struct codec {
+	int frames;		/* tape frames per word */
+	void (*dec)(unsigned char *, uint64_t *, int);  /* frames to words */
+	void (*enc)(uint64_t *, unsigned char *, int);  /* words to frames */
+	void (*check)(unsigned char *, int);  /* parity check, or NULL */
+};
+
+static struct codec tm03={ 5, dec5, enc5, NULL };  /* 9-track core dump */
+static struct codec track7={ 6, dec6, enc6, parcheck };  /* 7-track */
+
+static struct codec codec;	/* the one for this tape, see pickcodec() */
+static int reclen;		/* record length in bytes when writing */
+
+/* 7-track frame for each 6-bit character, with odd parity in bit 6 */
+static unsigned char par7[64] = {
+	0100,0001,0002,0103,0004,0105,0106,0007,	/* 000 */
+	0010,0111,0112,0013,0114,0015,0016,0117,	/* 010 */
+	0020,0121,0122,0023,0124,0025,0026,0127,	/* 020 */
+	0130,0031,0032,0133,0034,0135,0136,0037,	/* 030 */
+	0040,0141,0142,0043,0144,0045,0046,0147,	/* 040 */
+	0150,0051,0052,0153,0054,0155,0156,0057,	/* 050 */
+	0160,0061,0062,0163,0064,0165,0166,0067,	/* 060 */
+	0070,0171,0172,0073,0174,0075,0076,0177	/* 070 */
+};
+
+/* choose the codec for the tape being opened */
+/* called by opentape(), so nothing else has to test which format it is */
+void pickcodec()
+{
+	if(seven_track) codec=track7;
+	else {
+		codec=tm03;
+#ifdef X86SIMD				/* use the fastest this CPU can do */
+		__builtin_cpu_init();
+		if(__builtin_cpu_supports("avx2"))
+			codec.dec=dec5avx2, codec.enc=enc5avx2;
+		else if(__builtin_cpu_supports("ssse3"))
+			codec.dec=dec5ssse3, codec.enc=enc5ssse3;
+#endif
+	}
+
+	if(blocking<1||(long)codec.frames*WORDS*blocking>MAXRECLEN) {
+		fprintf(stderr,"?Blocking factor must be 1 to %ld\n",
+			MAXRECLEN/(codec.frames*WORDS));
+		exit(1);
+	}
+	reclen=codec.frames*WORDS*blocking;
+	if((tapebuf=realloc(tapebuf,reclen))==NULL) nomem();
+}
+
 /* prepare to begin writing or reading a record (call before switching r/w!) */
 /* (actually, only used for writing records now -- JMBW 07/14/98) */
 void resetbuf()
@@ -64,9 +148,11 @@ void resetbuf()
 /* flush tape output buffer if needed */
 void tapeflush()
 {
+	static uint64_t zero=0;
+
 	if(tapeptr!=tapebuf) {		/* something to flush */
 		while((tapeptr-tapebuf)<12)
-			outword(0L,0L);	/* pad if too short for tape hardware */
+			outwords(&zero,1);  /* pad if too short for tape hardware */
 					/* (records must be >= 12 bytes) */
 		putrec(tapebuf,tapeptr-tapebuf);
 		tapeptr=tapebuf;
@@ -76,141 +162,307 @@ void tapeflush()
 /* read tape record into buf, return 0 on success or -1 on EOF */
 int taperead()
 {
-	recl=getrec(tapebuf,RECLEN);
+	recl=getrecp(&tapeptr,reclen);
 	if(recl<=0) return(-1);	/* EOF */
-	if (seven_track) {
-		if(recl%6) {		/* 7-track tapes store words as 6 tape frames */
-			fprintf(stderr,"?Record length not word multiple\n");
-			exit(1);
-		}
-	} else {
-		if(recl%5) {		/* TM03 stores words as 5 tape frames */
-			fprintf(stderr,"?Record length not word multiple\n");
-			exit(1);
-		}
+	nrecs++;
+	if(recl%codec.frames) {		/* TM03 stores words as 5 tape frames, */
+					/* 7-track tapes as 6 */
+		fprintf(stderr,"?Record length not word multiple\n");
+		exit(1);
 	}
-	tapeptr=tapebuf;
+	if(checkparity&&codec.check)
+		(*codec.check)((unsigned char *)tapeptr,recl);
 	return(0);
 }
 
-/* read a word, store halfwords at the addresses given by call args */
-void inword(long *l,long *r)
+/* discard rest of current tape file without decoding it */
+/* leaves the tape positioned just past the tape mark, like taperead() */
+void tapeskip()
+{
+	recl=0;				/* rest of this record is history */
+	if(checkparity&&codec.check)	/* every frame must be checked */
+		while(taperead()==0) ;
+	else skipmark();
+}
+
+/* return # of words remaining in buffer */
+int remaining()
 {
-	register unsigned long a,b,c;
+	return(recl/codec.frames);
+}
 
-	if(recl==0) {			/* no more data */
+/* return # of words in a LEN-byte tape record */
+int recwords(int len)
+{
+	return(len/codec.frames);
+}
+
+/* decode word N of tape record BUF without disturbing the current record */
+/* (used by the index code to look inside records as they go by) */
+uint64_t recword(char *buf,int n)
+{
+	uint64_t w;
+
+	decrec(buf+n*codec.frames,codec.frames,&w);
+	return(w);
+}
+
+/* decode the N words in tape record BUF, LEN bytes long, into W[] */
+/* returns N */
+int decrec(char *buf,int len,uint64_t *w)
+{
+	int n=len/codec.frames;
+
+	(*codec.dec)((unsigned char *)buf,w,n);
+	return(n);
+}
+
+/* encode the N words in W[] into tape record BUF, return its length */
+int encrec(uint64_t *w,int n,char *buf)
+{
+	(*codec.enc)(w,(unsigned char *)buf,n);
+	return(n*codec.frames);
+}
+
+/* read N words from the current record into W[] */
+/* (it's an error if the record doesn't have that many left) */
+void inwords(uint64_t *w,int n)
+{
+	int len=n*codec.frames;
+
+	if(recl<len) {			/* not enough data */
 		fprintf(stderr,"?Tape record too short\n");
 		exit(1);
 	}
+	(*codec.dec)((unsigned char *)tapeptr,w,n);
+	tapeptr+=len;
+	recl-=len;			/* count them */
+}
 
-	if (seven_track) {
-		/* left half */
-		a=*tapeptr++;
-		b=*tapeptr++;
-		c=*tapeptr++;
-		*l=((a<<12)&0770000)|((b<<6)&0007700)|(c&077);
-
-		/* right half */
-		a=*tapeptr++;
-		b=*tapeptr++;
-		c=*tapeptr++;
-		*r=((a<<12)&0770000)|((b<<6)&0007700)|(c&077);
+/* discard N words from the current record */
+void skipwords(int n)
+{
+	int len=n*codec.frames;
 
-		recl -= 6;
-		return;
+	if(recl<len) {			/* not enough data */
+		fprintf(stderr,"?Tape record too short\n");
+		exit(1);
 	}
+	tapeptr+=len;
+	recl-=len;
+}
+
+/* as above but reads up to N words, going on to the next rec if needed */
+/* returns # words read into W[] (always > 0), or 0 on EOF */
+int nextwords(uint64_t *w,int n)
+{
+	if(recl==0)			/* no more data */
+		if(taperead()<0) return(0);
 
-	/* left half */
-	a=*tapeptr++;
-	b=*tapeptr++;
-	c=*tapeptr++;
-	*l=((a<<10)&0776000)|((b<<2)&0001774)|((c>>6)&03);
+	if(n>recl/codec.frames) n=recl/codec.frames;  /* rest of this record */
+	(*codec.dec)((unsigned char *)tapeptr,w,n);
+	tapeptr+=n*codec.frames;
+	recl-=n*codec.frames;
+	return(n);
+}
 
-	/* right half */
-	b=*tapeptr++;
-	a=*tapeptr++;
-	*r=((c<<12)&0770000)|((b<<4)&0007760)|(a&017);
+/* write the N words in W[], flushing each record as it fills up */
+void outwords(uint64_t *w,int n)
+{
+	int k;
 
-	recl-=5;			/* count it */
+	while(n>0) {
+		k=(tapebuf+reclen-tapeptr)/codec.frames;  /* room left in record */
+		if(k>n) k=n;
+		tapeptr+=encrec(w,k,tapeptr);
+		w+=k, n-=k;
+
+		/* see if the buffer needs to be flushed */
+		if(tapeptr==tapebuf+reclen) tapeflush();
+	}
 }
 
-/* as above but wraps to next rec if needed */
-/* returns -1 on EOF, 0 on success */
-int nextword(long *l,long *r)
+/* decode N TM03 words (5 frames each) from P into W[] */
+static void dec5(register unsigned char *p,register uint64_t *w,register int n)
 {
-	register unsigned long a,b,c;
+	while(n--) {
+		*w++=((uint64_t)p[0]<<28)|((uint64_t)p[1]<<20)|
+			((unsigned long)p[2]<<12)|((unsigned long)p[3]<<4)|
+			(p[4]&017);
+		p+=5;
+	}
+}
 
-	if(recl==0)			/* no more data */
-		if(taperead()<0) return(-1);
+/* decode N 7-track words (6 frames each, parity bits ignored) */
+static void dec6(register unsigned char *p,register uint64_t *w,register int n)
+{
+	while(n--) {
+		*w++=((uint64_t)(p[0]&077)<<30)|((uint64_t)(p[1]&077)<<24)|
+			((unsigned long)(p[2]&077)<<18)|
+			((unsigned long)(p[3]&077)<<12)|
+			((unsigned long)(p[4]&077)<<6)|(p[5]&077);
+		p+=6;
+	}
+}
 
-	if (seven_track) {
-		/* left half */
-		a=*tapeptr++;
-		b=*tapeptr++;
-		c=*tapeptr++;
-		*l=((a<<12)&0770000)|((b<<6)&0007700)|(c&077);
+/* encode N words from W[] into TM03 frames at P */
+/* (high 4 bits of the 5th frame are written as 0) */
+static void enc5(register uint64_t *w,register unsigned char *p,register int n)
+{
+	register uint64_t x;
+
+	while(n--) {
+		x=*w++;
+		p[0]=x>>28;
+		p[1]=x>>20;
+		p[2]=x>>12;
+		p[3]=x>>4;
+		p[4]=x&017;
+		p+=5;
+	}
+}
 
-		/* right half */
-		a=*tapeptr++;
-		b=*tapeptr++;
-		c=*tapeptr++;
-		*r=((a<<12)&0770000)|((b<<6)&0007700)|(c&077);
+/* encode N words from W[] into 7-track frames at P, with odd parity */
+static void enc6(register uint64_t *w,register unsigned char *p,register int n)
+{
+	register uint64_t x;
+
+	while(n--) {
+		x=*w++;
+		p[0]=par7[(x>>30)&077];
+		p[1]=par7[(x>>24)&077];
+		p[2]=par7[(x>>18)&077];
+		p[3]=par7[(x>>12)&077];
+		p[4]=par7[(x>>6)&077];
+		p[5]=par7[x&077];
+		p+=6;
+	}
+}
 
-		recl -= 6;
-		return 0;
+/* check the parity of each frame of LEN-byte 7-track record P */
+/* eight frames at a time:  fold each byte's 7 bits down to bit 0, which must */
+/* then be 1 (odd parity) in every byte, and bit 7 must be 0 */
+static void parcheck(unsigned char *p,int len)
+{
+	static const uint64_t ones=0x0101010101010101ULL;
+	uint64_t x, t, bad=0;
+	long long pos;
+	int i, first=(-1), nbad=0;
+
+	for(i=0;i+8<=len;i+=8) {
+		memcpy(&x,p+i,8);
+		t=x&(ones*0177);
+		t^=(t>>4)&(ones*017);
+		t^=(t>>2)&(ones*03);
+		t^=(t>>1)&ones;
+		bad|=((t&ones)^ones)|(x&(ones*0200));
 	}
+	for(;i<len;i++)			/* leftover frames */
+		if(par7[p[i]&077]!=p[i]) bad=1;
+	if(!bad) return;
+
+	/* something's wrong, go back and find out what */
+	for(i=0;i<len;i++)
+		if(par7[p[i]&077]!=p[i]) {
+			if(first<0) first=i;
+			nbad++;
+		}
+	parerrs++;
+	fprintf(stderr,"WARNING: %d frame%s with bad parity in record ",
+		nbad,nbad==1?"":"s");
+	if((pos=recoffset())>=0)
+		fprintf(stderr,"at image offset %lld",pos);
+	else fprintf(stderr,"%lu",nrecs);
+	fprintf(stderr,", first at frame %d (%03o)\n",first,p[first]);
+}
 
-	/* left half */
-	a=*tapeptr++;
-	b=*tapeptr++;
-	c=*tapeptr++;
-	*l=((a<<10)&0776000)|((b<<2)&0001774)|((c>>6)&03);
+#ifdef X86SIMD
+/*
+  Vector versions of dec5() and enc5().  A TM03 word is 5 frames, so a
+  16-byte load holds two whole words.  A byte shuffle turns each word's
+  frames into a little-endian 40-bit number in a 64-bit lane:
+
+	lane:  000000000000000000000000 44444444 33333333 ... 00000000
+	       (frame # of each byte, frame 4 is the low byte)
+
+  and the word is that shifted right 4 bits, except for the low 4 bits,
+  which come straight from frame 4 (its high 4 bits are "don't care").
+  Encoding does the reverse.  The AVX2 versions do two such 128-bit lanes
+  (four words) at a time.  Loads and stores may go up to 6 bytes past the
+  words being converted, so the loops stop early enough that those bytes
+  are still within the frames being read or written, and plain C finishes
+  the last few words.
+*/
 
-	/* right half */
-	b=*tapeptr++;
-	a=*tapeptr++;
-	*r=((c<<12)&0770000)|((b<<4)&0007760)|(a&017);
+/* byte shuffle from frames to lanes, and back */
+#define UNFRAME 4,3,2,1,0,-1,-1,-1, 9,8,7,6,5,-1,-1,-1
+#define REFRAME 4,3,2,1,0,12,11,10, 9,8,-1,-1,-1,-1,-1,-1
 
-	recl-=5;			/* count it */
-	return(0);
+__attribute__((target("ssse3")))
+static void dec5ssse3(unsigned char *p,uint64_t *w,int n)
+{
+	__m128i shuf=_mm_setr_epi8(UNFRAME),
+		low=_mm_set1_epi64x(017), x;
+
+	for(;n>=4;n-=2,p+=10,w+=2) {
+		x=_mm_shuffle_epi8(_mm_loadu_si128((__m128i *)p),shuf);
+		x=_mm_or_si128(_mm_andnot_si128(low,_mm_srli_epi64(x,4)),
+			_mm_and_si128(low,x));
+		_mm_storeu_si128((__m128i *)w,x);
+	}
+	dec5(p,w,n);
 }
 
-/* return # of words remaining in buffer */
-int remaining()
+__attribute__((target("ssse3")))
+static void enc5ssse3(uint64_t *w,unsigned char *p,int n)
 {
-	if (seven_track)
-		return(recl/6);
-	else
-		return(recl/5);
+	__m128i shuf=_mm_setr_epi8(REFRAME),
+		low=_mm_set1_epi64x(017), x;
+
+	for(;n>=4;n-=2,p+=10,w+=2) {
+		x=_mm_loadu_si128((__m128i *)w);
+		x=_mm_or_si128(_mm_slli_epi64(_mm_andnot_si128(low,x),4),
+			_mm_and_si128(low,x));
+		_mm_storeu_si128((__m128i *)p,_mm_shuffle_epi8(x,shuf));
+	}
+	enc5(w,p,n);
 }
 
-/* write a word */
-void outword(register unsigned long l,register unsigned long r)
+__attribute__((target("avx2")))
+static void dec5avx2(unsigned char *p,uint64_t *w,int n)
 {
-	if (seven_track) {
-		int i, c, p;
-		for (i = 0; i < 3; i++) {
-			c = (l >> 12) & 077;
-			p = 0100 ^ (c << 1) ^ (c << 2) ^ (c << 3) ^ (c << 4) ^ (c << 5) ^ (c << 6);
-			c |= p & 0100;
-			*tapeptr++ = c;
-			l <<= 6;
-		}
-		for (i = 0; i < 3; i++) {
-			c = (r >> 12) & 077;
-			p = 0100 ^ (c << 1) ^ (c << 2) ^ (c << 3) ^ (c << 4) ^ (c << 5) ^ (c << 6);
-			c |= p & 0100;
-			*tapeptr++ = c;
-			r <<= 6;
-		}
-	} else {
-		*tapeptr++=(l>>10)&0377;
-		*tapeptr++=(l>>2)&0377;
-		*tapeptr++=((l<<6)&0300)|((r>>12)&077);
-		*tapeptr++=(r>>4)&0377;
-		*tapeptr++=r&017;
+	__m256i shuf=_mm256_setr_epi8(UNFRAME,UNFRAME),
+		low=_mm256_set1_epi64x(017), x;
+
+	for(;n>=6;n-=4,p+=20,w+=4) {
+		x=_mm256_inserti128_si256(_mm256_castsi128_si256(
+			_mm_loadu_si128((__m128i *)p)),
+			_mm_loadu_si128((__m128i *)(p+10)),1);
+		x=_mm256_shuffle_epi8(x,shuf);
+		x=_mm256_or_si256(
+			_mm256_andnot_si256(low,_mm256_srli_epi64(x,4)),
+			_mm256_and_si256(low,x));
+		_mm256_storeu_si256((__m256i *)w,x);
 	}
+	dec5(p,w,n);
+}
 
-	/* see if the buffer needs to be flushed */
-	if(tapeptr==tapebuf+RECLEN) tapeflush();
+__attribute__((target("avx2")))
+static void enc5avx2(uint64_t *w,unsigned char *p,int n)
+{
+	__m256i shuf=_mm256_setr_epi8(REFRAME,REFRAME),
+		low=_mm256_set1_epi64x(017), x;
+
+	for(;n>=6;n-=4,p+=20,w+=4) {
+		x=_mm256_loadu_si256((__m256i *)w);
+		x=_mm256_or_si256(
+			_mm256_slli_epi64(_mm256_andnot_si256(low,x),4),
+			_mm256_and_si256(low,x));
+		x=_mm256_shuffle_epi8(x,shuf);
+		_mm_storeu_si128((__m128i *)p,_mm256_castsi256_si128(x));
+		_mm_storeu_si128((__m128i *)(p+10),
+			_mm256_extracti128_si256(x,1));
+	}
+	enc5(w,p,n);
 }
+#endif
@@ -9,6 +9,14 @@
   08/09/1993  JMBW  Convert dates, uncompress .Z files automatically.
   07/14/1998  JMBW  Separated from DUMP.C.
 
+  unpack() sends the words straight to the tape (unpackstream() does the
+  same for a file that's already open).  unpackbuf() collects them
+  in memory instead (see pool.c), and can run in several threads at once
+  since everything about the file being read is thread-local.
+
+  Entry points:
+  unpack, unpackstream, unpackopen, unpackbuf.
+
   This file is part of itstar.
 
   itstar is free software: you can redistribute it and/or modify
@@ -27,22 +35,52 @@
 */
 
 #include <fcntl.h>
+#include <stdint.h>
 #define zopen apple_zopen
 #include <stdio.h>
 #undef zopen
 #include <stdlib.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <time.h>
 #include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "itstar.h"
 
-FILE *in, *out;
-
 FILE *zopen(char *);
-static void flush(unsigned long word[5]);
+void nomem();
+static void unpackf(char *), putwords(uint64_t *, int);
+static int fill(), plainbytes(unsigned char *, int);
+
+static _Thread_local FILE *in;	/* file being read */
+
+/* input files bigger than INBUF are mapped into memory if possible, */
+/* anything else is read in big chunks into INBUF */
+static _Thread_local unsigned char inbuf[64*1024];
+static _Thread_local unsigned char *inptr, *inend;
+				/* next char, end of chars in INBUF */
+static _Thread_local unsigned char *inmap;  /* base of mapped file, or NULL */
+static _Thread_local unsigned long inbase;  /* file offset of INBUF[0] */
+static _Thread_local size_t inmaplen;	/* its length */
+
+/* macro to get the next input char, or EOF */
+#define inbyte() (inptr<inend?*inptr++:fill())
+
+static _Thread_local uint64_t words[1024];  /* words waiting for putwords() */
+static _Thread_local int nwords;
+
+/* where putwords() puts them for unpackbuf(), or NULL to write them */
+static _Thread_local uint64_t *buf;
+static _Thread_local unsigned long nbuf, maxbuf;
+
+/* macro to queue one 36-bit word for the tape */
+#define putword(w) { words[nwords++]=(w);\
+	if(nwords==sizeof(words)/sizeof(words[0])) putwords(words,nwords),nwords=0; }
 
 /*
  
@@ -215,77 +253,224 @@ NONE, NONE, NONE, NONE, NONE, NONE, NONE, 0007,	/* 170 */
 0150, 0151, 0152, 0153, 0154, 0155, NONE, NONE	/* 350 */
 };
 
+/* unpack FILE onto the tape */
 void unpack(char *file)
 {
-	register int c;
-	register char b;
-	register int i;
-	static unsigned long word[5];
-	static unsigned long incnt;
+	unpackstream(unpackopen(file),file);
+}
+
+/* unpack FILE, already open as F, onto the tape */
+void unpackstream(FILE *f,char *file)
+{
+	in=f;
+	buf=NULL;
+	unpackf(file);
+}
+
+/* open FILE for unpack() or unpackbuf() */
+FILE *unpackopen(char *file)
+{
+	FILE *f;
 
-	in=zopen(file);	/* uncompress/open file */
-	if(in==NULL) {
+	f=zopen(file);	/* uncompress/open file */
+	if(f==NULL) {
 		perror(file);
 		exit(1);
 	}
+	return(f);
+}
+
+/* unpack FILE, already open as F, into *W (malloc()ed), set *N to the */
+/* number of words */
+void unpackbuf(FILE *f,char *file,uint64_t **w,unsigned long *n)
+{
+	in=f;
+	maxbuf=1024;
+	if((buf=malloc(maxbuf*sizeof(uint64_t)))==NULL) nomem();
+	nbuf=0;
+	unpackf(file);
+	*w=buf, *n=nbuf;
+}
+
+/* unpack the file open as IN (called FILE, for messages), and close it */
+static void unpackf(char *file)
+{
+	register int c;
+	register char b;
+	register int i;
+	register unsigned char *p;
+	register uint64_t w;
+	unsigned char quote[4];
+	struct stat st;
+	int n;
+
+	inmap=NULL;
+	if(fstat(fileno(in),&st)==0&&S_ISREG(st.st_mode)&&
+		st.st_size>sizeof(inbuf)&&(size_t)st.st_size==st.st_size) {
+		inmap=mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,fileno(in),0);
+		if(inmap==MAP_FAILED) inmap=NULL;  /* read it then */
+		else {
+			inmaplen=st.st_size;
+			madvise(inmap,inmaplen,MADV_SEQUENTIAL);
+		}
+	}
 
-	incnt=0L;	/* used for error msgs if file invalid */
-	while((incnt++,c=getc(in))!=EOF) {
+	inbase=0L;	/* used for error msgs if file invalid */
+	nwords=0;
+	if(inmap) inptr=inmap, inend=inmap+inmaplen;  /* have it all now */
+	else inptr=inend=inbuf;
+	for(;;) {
+		/* at a word boundary, a run of chars that stand for themselves */
+		/* goes straight into words, 5 chars per word */
+		if((n=plainbytes(inptr,inend-inptr)/5)>0) {
+			for(p=inptr;n--;p+=5)
+				putword(((uint64_t)p[0]<<29)|
+					((uint64_t)p[1]<<22)|
+					((unsigned long)p[2]<<15)|
+					((unsigned long)p[3]<<8)|
+					((unsigned long)p[4]<<1));
+			inptr=p;
+		}
+
+		if((c=inbyte())==EOF) break;
 		if(c>=0360) {	/* quoted binary word */
-			word[0]=(c&017);
-			for(i=1;i<=4;i++) {  /* 4 more bytes */
-				if((incnt++,word[i]=getc(in))==EOF) {
-					fprintf(stderr,
-					"?Unexpected EOF: %s\n",file);
-					exit(1);
+			if(inend-inptr>=4) {	/* all in buffer, easy */
+				p=inptr;
+				inptr+=4;
+			}
+			else {		/* straddles refill, or truncated */
+				for(i=0;i<4;i++) {  /* 4 more bytes */
+					if((n=inbyte())==EOF) {
+						fprintf(stderr,
+						"?Unexpected EOF: %s\n",file);
+						exit(1);
+					}
+					quote[i]=n;
 				}
+				p=quote;
 			}
 			/* assemble the 36-bit binary word */
-			outword((word[0]<<14L)|(word[1]<<6L)|
-				((word[2]>>2L)&077L),
-				((word[2]&003L)<<16L)|
-				(word[3]<<8L)|word[4]);
+			putword(((uint64_t)(c&017)<<32)|
+				((uint64_t)p[0]<<24)|((unsigned long)p[1]<<16)|
+				((unsigned long)p[2]<<8)|p[3]);
 		}
 		else {
-			word[0]=first[c], i=1;	/* write first char */
-			if(!((b=second[c])&NONE)) word[i++]=b;
+			/* 7-bit chars pile up in W until there are 5 */
+			w=first[c], i=1;	/* write first char */
+			if(!((b=second[c])&NONE)) w=(w<<7)|b, i++;
 			/* loop until word boundary */
 			while(i) {
 				/* start next sequence */
-				if((incnt++,c=getc(in))==EOF) {
+				if((c=inbyte())==EOF) {
 					/* pad with ^C's on EOF */
-					while(i<5) word[i++]=003;
-					flush(word);
+					for(;i<5;i++) w=(w<<7)|003;
+					putword(w<<1);
 					goto done;
 				}
 				/* quoted word not allowed mid-word */
 				if(c>=0360) {
 					fprintf(stderr,
 				"?Invalid input file:  %s, char %lu\n",
-					file,incnt);
+					file,inbase+(inptr-(inmap?inmap:inbuf)));
 					exit(1);
 				}
 				/* save the first char */
-				word[i++]=first[c];
-				if(i==5) flush(word), i=0;
+				w=(w<<7)|first[c];
+				if(++i==5) {
+					putword(w<<1);
+					w=0, i=0;
+				}
 				/* save 2nd char if any */
 				if(!((b=second[c])&NONE)) {
-					word[i++]=b;
-					if(i==5) flush(word), i=0;
+					w=(w<<7)|b;
+					if(++i==5) {
+						putword(w<<1);
+						w=0, i=0;
+					}
 				}
 			}
 		}
 	}
-done:	fclose(in);
+done:	putwords(words,nwords);	/* send off the last few words */
+	if(inmap) munmap(inmap,inmaplen);
+	fclose(in);
 //	unlink(file);	/* delete when done - /tmp isn't big enough on */
 			/* CIEUNIX.RPI.EDU */
 }
 
-/* flush 5 7-bit ASCII chars as a 36-bit word */
-static void flush(unsigned long word[5])
+/* send the N words in W[] to the tape, or to BUF if it's set */
+static void putwords(uint64_t *w,int n)
 {
-	register unsigned long l, r;
-	l=(word[0]<<11L)|(word[1]<<4L)|((word[2]>>3L)&017L);
-	r=((word[2]&07L)<<15L)|(word[3]<<8L)|(word[4]<<1L);
-	outword(l,r);
+	if(buf==NULL) {
+		outwords(w,n);
+		return;
+	}
+	if(nbuf+n>maxbuf) {
+		while(nbuf+n>maxbuf) maxbuf*=2;
+		if((buf=realloc(buf,maxbuf*sizeof(uint64_t)))==NULL) nomem();
+	}
+	memcpy(buf+nbuf,w,n*sizeof(uint64_t));
+	nbuf+=n;
+}
+
+/* refill INBUF, return first char or EOF */
+static int fill()
+{
+	size_t n;
+
+	if(inmap) return(EOF);		/* already had the whole file */
+	inbase+=inend-inbuf;		/* count what we're done with */
+	if((n=fread(inbuf,1,sizeof(inbuf),in))==0) {
+		if(ferror(in)) {
+			perror("?File read error");
+			exit(1);
+		}
+		return(EOF);
+	}
+	inptr=inbuf, inend=inbuf+n;
+	return(*inptr++);
+}
+
+/* return the length of the run of N chars at P that stand for themselves, */
+/* i.e. anything but 012, 015, 177 and 200-377 (see FIRST[] and SECOND[]) */
+static int plainbytes(unsigned char *p,int n)
+{
+	int i=0;
+#ifdef __SSE2__
+	__m128i x;
+	int m;
+#else
+	uint64_t x, v;
+#endif
+
+#ifdef SCALAR			/* reference build for "make test" */
+	return(0);
+#endif
+#ifdef __SSE2__
+	for(;i+16<=n;i+=16) {		/* 16 at a time */
+		x=_mm_loadu_si128((__m128i *)(p+i));
+		m=_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(x,  /* b7 */
+			_mm_cmpeq_epi8(x,_mm_set1_epi8(012))),
+			_mm_or_si128(_mm_cmpeq_epi8(x,_mm_set1_epi8(015)),
+			_mm_cmpeq_epi8(x,_mm_set1_epi8(0177)))));
+		if(m) return(i+__builtin_ctz(m));
+	}
+#else
+	/* 8 at a time, with the usual trick to find a zero byte applied */
+	/* to X XOR each char we're looking for */
+	for(;i+8<=n;i+=8) {
+		memcpy(&x,p+i,8);
+#define HASZERO(v) (((v)-0x0101010101010101ULL)&~(v)&0x8080808080808080ULL)
+		if(x&0x8080808080808080ULL) break;
+		v=x^0x0A0A0A0A0A0A0A0AULL;
+		if(HASZERO(v)) break;
+		v=x^0x0D0D0D0D0D0D0D0DULL;
+		if(HASZERO(v)) break;
+		v=x^0x7F7F7F7F7F7F7F7FULL;
+		if(HASZERO(v)) break;
+#undef HASZERO
+	}
+#endif
+	for(;i<n&&p[i]<0200&&p[i]!=012&&p[i]!=015&&p[i]!=0177;i++) ;
+	return(i);
 }
@@ -0,0 +1,402 @@
+/*
+
+  Walk directory trees for -c and -r.
+
+  Each directory is read in one go (with getdents64() under Linux, so there's
+  no stdio or per-entry malloc() involved), every entry but subdirectories
+  is fstatat()ed relative to the open directory, and the entries are sorted
+  by name, so the tape comes out the same no matter what order the file
+  system keeps them in.  The names of a directory's entries all live in one
+  buffer (the directory's "arena"), and a full pathname is only put together
+  when a file is actually saved.
+
+  With -j, a pool of threads reads directories ahead of the main thread,
+  which goes through the tree in order (depth first, each directory sorted)
+  saving files, and reads any directory the threads haven't gotten to yet
+  itself, rather than waiting.  On slow (NFS) file systems that hides most
+  of the time spent waiting for directory and inode lookups.
+
+  A directory with a DIR.LIST is left for dirlist() and not looked inside.
+
+  Entry points:
+  walk.
+
+  This file is part of itstar.
+
+  itstar is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  itstar is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with itstar.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#define _GNU_SOURCE		/* for fstatat(), O_DIRECTORY etc. */
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#include "itstar.h"
+
+void nomem();
+extern int jobs;
+
+#define DIRBUF (32*1024)	/* bytes of directory read at a time */
+
+struct entry {			/* one entry in a directory */
+	char *name;		/* its name (in the directory's arena) */
+	unsigned long off;	/* offset of name in arena */
+	mode_t mode;		/* type (and permissions, unless dir) */
+	time_t mtime, atime;	/* its dates (unless dir) */
+	struct dnode *dir;	/* if it's a directory, its contents */
+};
+
+struct dnode {			/* one directory */
+	struct dnode *next, *prev;  /* neighbors in queue to be read */
+	int state;		/* QUEUED, READING or READ */
+	int listed;		/* NZ => has DIR.LIST, so we didn't look */
+	char *arena;		/* names of entries */
+	struct entry *ents;	/* entries, sorted by name */
+	unsigned long nents;
+	char path[1];		/* its pathname (malloc()ed to fit) */
+};
+#define QUEUED 0		/* (in queue if there are threads) */
+#define READING 1
+#define READ 2
+
+static pthread_mutex_t lock=PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work=PTHREAD_COND_INITIALIZER;  /* for readers */
+static pthread_cond_t done=PTHREAD_COND_INITIALIZER;  /* for main thread */
+static struct dnode *head=NULL, *tail=NULL;  /* directories to be read */
+static int quit;		/* NZ => threads should stop */
+static int nthreads=0;
+
+struct names {			/* names being read into a dnode */
+	struct dnode *n;
+	unsigned long len, max;	/* bytes used in, size of arena */
+	unsigned long maxents;	/* size of ents[] */
+	int checklist;		/* NZ => stop if there's a DIR.LIST */
+};
+
+static struct dnode *dnode(char *, int, char *);
+static void visit(int, char **, struct dnode *), readdirs(struct dnode *, int);
+static void dequeue(struct dnode *), freenode(struct dnode *);
+static int getnames(int, struct names *), addname(struct names *, char *, int);
+static void *reader(void *);
+static int compare(const void *, const void *);
+
+/* save all files in directory tree D (which has been lstat()ed already) */
+void walk(int argc,char **argv,char *d)
+{
+	pthread_t *t=NULL;
+	struct dnode *n;
+	int i;
+
+	n=dnode(d,strlen(d),NULL);
+	head=tail=NULL;
+	quit=0;
+	nthreads=(jobs>1)?jobs:0;
+	if(nthreads) {
+		if((t=malloc(nthreads*sizeof(pthread_t)))==NULL) nomem();
+		for(i=0;i<nthreads;i++)
+			if((errno=pthread_create(&t[i],NULL,reader,NULL))!=0) {
+				perror("?Can't start thread");
+				exit(1);
+			}
+	}
+
+	n->state=READING;		/* (never queued) */
+	readdirs(n,1);
+	visit(argc,argv,n);
+
+	if(nthreads) {
+		pthread_mutex_lock(&lock);
+		quit=1;
+		pthread_cond_broadcast(&work);
+		pthread_mutex_unlock(&lock);
+		for(i=0;i<nthreads;i++) pthread_join(t[i],NULL);
+		free(t);
+	}
+}
+
+/* save everything in directory N, in order, and free it */
+static void visit(int argc,char **argv,struct dnode *n)
+{
+	static char *path=NULL;		/* pathname being saved */
+	static unsigned long pathlen=0;	/* size of PATH[] */
+	struct entry *e;
+	struct stat s;
+	unsigned long i, l, len;
+
+	/* read it ourselves unless a thread already is (or has) */
+	pthread_mutex_lock(&lock);
+	if(n->state==QUEUED) {
+		if(nthreads) dequeue(n);
+		n->state=READING;
+		pthread_mutex_unlock(&lock);
+		readdirs(n,1);
+		pthread_mutex_lock(&lock);
+	}
+	else while(n->state!=READ) pthread_cond_wait(&done,&lock);
+	pthread_mutex_unlock(&lock);
+
+	/* if it has a DIR.LIST, that says what to save */
+	if(n->listed) {
+		if(dirlist(argc,argv,n->path)==0) {
+			freenode(n);
+			return;
+		}
+		/* (DIR.LIST is a dangling link or some such, do it by hand) */
+		readdirs(n,0);
+	}
+
+	for(i=0,e=n->ents;i<n->nents;i++,e++) {
+		if(e->dir) {		/* subdirectory, recurse */
+			visit(argc,argv,e->dir);
+			continue;
+		}
+		/* path, /, name, NUL */
+		len=strlen(n->path);
+		l=len+1+strlen(e->name)+1;
+		if(l>pathlen) {
+			if((path=realloc(path,l))==NULL) nomem();
+			pathlen=l;
+		}
+		memcpy(path,n->path,len);
+		path[len]='/';
+		strcpy(path+len+1,e->name);
+
+		/* the rest of the stat() info isn't used */
+		memset(&s,0,sizeof(s));
+		s.st_mode=e->mode;
+		s.st_mtime=e->mtime;
+		s.st_atime=e->atime;
+		addentry(path,&s);
+	}
+	freenode(n);
+}
+
+/* reader thread, read directories ahead of the main thread until told */
+/* to quit */
+static void *reader(void *arg)
+{
+	struct dnode *n;
+
+	for(;;) {
+		pthread_mutex_lock(&lock);
+		while(head==NULL&&!quit) pthread_cond_wait(&work,&lock);
+		if(head==NULL) {	/* quitting */
+			pthread_mutex_unlock(&lock);
+			return(NULL);
+		}
+		n=head;
+		dequeue(n);
+		n->state=READING;
+		pthread_mutex_unlock(&lock);
+		readdirs(n,1);
+	}
+}
+
+/* make a node for directory PATH (LEN chars), in directory PARENT */
+/* (or at the top if NULL) */
+static struct dnode *dnode(char *path,int len,char *parent)
+{
+	struct dnode *n;
+	int l=parent?strlen(parent)+1:0;
+
+	if((n=malloc(sizeof(struct dnode)+l+len))==NULL) nomem();
+	if(parent) {
+		memcpy(n->path,parent,l-1);
+		n->path[l-1]='/';
+	}
+	memcpy(n->path+l,path,len);
+	n->path[l+len]='\0';
+	n->next=n->prev=NULL;
+	n->state=QUEUED;
+	n->listed=0;
+	n->arena=NULL;
+	n->ents=NULL;
+	n->nents=0;
+	return(n);
+}
+
+/* read directory N into N->ENTS[], sorted, and mark it READ; stop early */
+/* if CHECKLIST is NZ and it has a DIR.LIST, just setting N->LISTED */
+static void readdirs(struct dnode *n,int checklist)
+{
+	struct names l;
+	struct entry *e;
+	struct stat s;
+	struct dnode *first=NULL, *last=NULL;
+	unsigned long i;
+	int fd;
+
+	if((fd=open(n->path,O_RDONLY|O_DIRECTORY))<0) {
+		fprintf(stderr,"?Error opening directory %s\n",n->path);
+		exit(1);
+	}
+	n->nents=0;
+	l.n=n;
+	l.len=l.max=l.maxents=0;
+	l.checklist=checklist;
+	if(getnames(fd,&l)) {		/* has DIR.LIST */
+		n->listed=1;		/* dirlist() takes it from here */
+		n->nents=0;
+		goto out;
+	}
+
+	/* now that the arena has stopped moving, point at names, sort */
+	for(i=0,e=n->ents;i<n->nents;i++,e++) e->name=n->arena+e->off;
+	qsort(n->ents,n->nents,sizeof(struct entry),compare);
+
+	/* look up everything but directories (which needn't be looked up) */
+	for(i=0,e=n->ents;i<n->nents;i++,e++) {
+		if(!S_ISDIR(e->mode)) {
+			if(fstatat(fd,e->name,&s,AT_SYMLINK_NOFOLLOW)<0) {
+				fprintf(stderr,"?Error accessing %s/%s\n",
+					n->path,e->name);
+				exit(1);
+			}
+			e->mode=s.st_mode;
+			e->mtime=s.st_mtime;
+			e->atime=s.st_atime;
+		}
+		if(S_ISDIR(e->mode)) {
+			e->dir=dnode(e->name,strlen(e->name),n->path);
+			if(last) last->next=e->dir, e->dir->prev=last;
+			else first=e->dir, e->dir->prev=NULL;
+			last=e->dir;
+		}
+	}
+out:
+	close(fd);
+
+	/* mark it read, and put its subdirectories at the front of the */
+	/* queue, so the threads read what the main thread will want soon */
+	pthread_mutex_lock(&lock);
+	n->state=READ;
+	pthread_cond_broadcast(&done);
+	if(nthreads&&first) {
+		if((last->next=head)!=NULL) head->prev=last;
+		else tail=last;
+		head=first;
+		pthread_cond_broadcast(&work);
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+/* read the names in directory FD into L->N's arena and entries */
+/* return NZ if L->CHECKLIST is set and there's a DIR.LIST */
+static int getnames(int fd,struct names *l)
+{
+#ifdef __linux__
+	static _Thread_local char buf[DIRBUF];
+	struct d64 {			/* what getdents64() returns */
+		uint64_t ino;
+		int64_t off;
+		unsigned short reclen;
+		unsigned char type;
+		char name[1];
+	} *d;
+	long k, off;
+
+	while((k=syscall(SYS_getdents64,fd,buf,sizeof(buf)))>0)
+		for(off=0;off<k;off+=d->reclen) {
+			d=(struct d64 *)(buf+off);
+			if(addname(l,d->name,d->type)) return(1);
+		}
+	if(k<0) {
+#else
+	struct dirent *d;
+	DIR *dir;
+
+	if((dir=fdopendir(dup(fd)))==NULL) {
+		fprintf(stderr,"?Error reading directory %s\n",l->n->path);
+		exit(1);
+	}
+	while((d=readdir(dir))!=NULL)
+		if(addname(l,d->d_name,d->d_type)) {
+			closedir(dir);
+			return(1);
+		}
+	if(closedir(dir)<0) {
+#endif
+		fprintf(stderr,"?Error reading directory %s\n",l->n->path);
+		exit(1);
+	}
+	return(0);
+}
+
+/* add NAME (of type TYPE, DT_xxx) to L, return NZ if it's a DIR.LIST and */
+/* we're looking for one */
+static int addname(struct names *l,char *name,int type)
+{
+	struct dnode *n=l->n;
+	struct entry *e;
+	int len;
+
+	if(name[0]=='.')		/* ignore ./.., hidden files */
+		return(0);
+	if(l->checklist&&(strcmp(name,"DIR.LIST")==0||
+		strcmp(name,"DIR.LIST.Z")==0||strcmp(name,"DIR.LIST.gz")==0))
+		return(1);
+	len=strlen(name)+1;
+	if(l->len+len>l->max) {
+		l->max=l->max?l->max*2:4096;
+		if(l->max<l->len+len) l->max=l->len+len;
+		if((n->arena=realloc(n->arena,l->max))==NULL) nomem();
+	}
+	if(n->nents>=l->maxents) {
+		l->maxents=l->maxents?l->maxents*2:64;
+		if((n->ents=realloc(n->ents,l->maxents*sizeof(struct entry)))==
+			NULL) nomem();
+	}
+	memcpy(n->arena+l->len,name,len);
+	e=&n->ents[n->nents++];
+	e->off=l->len;			/* (arena may move yet) */
+	e->mode=(type==DT_DIR)?S_IFDIR:0;  /* (the rest comes later) */
+	e->dir=NULL;
+	l->len+=len;
+	return(0);
+}
+
+/* take directory N off the queue (LOCK must be held) */
+static void dequeue(struct dnode *n)
+{
+	if(n->prev) n->prev->next=n->next;
+	else head=n->next;
+	if(n->next) n->next->prev=n->prev;
+	else tail=n->prev;
+}
+
+/* free directory N (its subdirectories have been freed already) */
+static void freenode(struct dnode *n)
+{
+	free(n->arena);
+	free(n->ents);
+	free(n);
+}
+
+/* qsort() comparison routine for readdirs(), sorts entries by name */
+static int compare(const void *a,const void *b)
+{
+	return(strcmp(((struct entry *)a)->name,((struct entry *)b)->name));
+}
@@ -0,0 +1,452 @@
+/*
+
+  Compressed (gzip) tape image files.
+
+  Images whose first bytes are the gzip magic number are decompressed on the
+  fly as tapeio.c reads them, so "itstar -t -f foo.tap.gz" works without
+  unpacking the image first, from a pipe too.
+
+  Images created with a name ending in ".gz" are written compressed.  The
+  image is cut into ZBLOCK-byte blocks, and each block is compressed by
+  itself as a separate gzip member (which gunzip/zcat just run together),
+  so with -j several threads can compress blocks at once while the main
+  thread writes the ones that are done, in order.
+
+  Each member we write has an extra header field (subfield "IT") giving the
+  member's own length and the number of image bytes in it, so seeking to any
+  image offset (for an index-driven extract, say) means hopping along the
+  member headers to the right block and decompressing just that block up to
+  the offset.  Plain gzip images can be seeked on too, but only by reading
+  from the start (or from where we are, going forwards).
+
+  Entry points:
+  zimage, zimgin, zimgget, zimgseek, zimgout, zimgput, zimgend.
+
+  This file is part of itstar.
+
+  itstar is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  itstar is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with itstar.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "itstar.h"
+
+void nomem();
+
+#define ZBLOCK (256*1024)	/* image bytes per gzip member written */
+#define ZINLEN (64*1024)	/* compressed bytes read at a time */
+#define HDRLEN 24		/* length of our gzip member header */
+
+static int zfd;			/* image file descriptor */
+
+/* reading */
+static z_stream zin;		/* decompressor */
+static unsigned char zinbuf[ZINLEN];
+static unsigned char *zinbase;	/* buffer ZIN.NEXT_IN points into */
+static unsigned char *zpeek=NULL;  /* bytes tapeio.c peeked at, if any */
+static int zeof;		/* NZ => no more compressed data */
+static int zmember;		/* NZ => partway through a gzip member */
+static long long zpos;		/* image offset of next byte to return */
+static long long zbase;		/* file offset of zinbase[0] */
+
+struct zblk {			/* one member of an image we wrote */
+	long long cpos;		/* its file offset */
+	long long upos;		/* image offset of its first byte */
+};
+static struct zblk *zblks=NULL;	/* all members in order, see zblocks() */
+static long nzblks=(-1);	/* # members, 0 if not blocked, -1 if unknown */
+static long zcur=(-1);		/* member we're reading, -1 if unknown */
+
+/* writing */
+struct zslot {			/* one block being compressed */
+	unsigned char *in;	/* image bytes */
+	unsigned long n;	/* # bytes in IN[] */
+	unsigned char *out;	/* the gzip member */
+	unsigned long outlen;	/* its length */
+	unsigned long outmax;	/* size of OUT[] */
+	z_stream z;		/* compressor */
+	int done;		/* NZ => OUT[] is ready to be written */
+};
+static struct zslot *slots=NULL;
+static int nslots=0, nthreads=0;
+static unsigned long zfill=0;	/* # blocks queued (next one being filled) */
+static unsigned long zcomp=0;	/* # blocks taken by compressor threads */
+static unsigned long zwrote=0;	/* # blocks written */
+static int zquit=0;		/* NZ => threads should stop */
+static pthread_t *zthreads;
+static pthread_mutex_t zlock=PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t zwork=PTHREAD_COND_INITIALIZER;  /* for threads */
+static pthread_cond_t zdone=PTHREAD_COND_INITIALIZER;  /* for main thread */
+
+static void corrupt(), zblocks(), zrestart(long long, long long);
+static void zqueue(), zwrite(struct zslot *), zcompress(struct zslot *);
+static void *zthread(void *);
+static void put32(unsigned char *, unsigned long);
+static unsigned long get32(unsigned char *);
+
+/* return NZ if the N bytes at P (N >= 2) start a compressed image */
+int zimage(char *p,int n)
+{
+	return(n>=2&&(p[0]&0377)==037&&(p[1]&0377)==0213);
+}
+
+/* start decompressing image FD, whose first N bytes (already read, maybe */
+/* from a pipe) are in BUF[] -- if FD is seekable, its file offset must */
+/* still be N */
+void zimgin(int fd,char *buf,unsigned long n)
+{
+	zfd=fd;
+	memset(&zin,0,sizeof(zin));
+	if(inflateInit2(&zin,15+16)!=Z_OK) nomem();  /* gzip only */
+	/* (take all of them, however many tapeio.c had to read) */
+	free(zpeek);
+	if((zpeek=malloc(n?n:1))==NULL) nomem();
+	memcpy(zpeek,buf,n);
+	zin.next_in=zinbase=zpeek;
+	zin.avail_in=n;
+	zbase=0;
+	zeof=zmember=0;
+	zpos=0;
+}
+
+/* decompress up to LEN bytes of the image into BUF[], return # bytes */
+/* (0 at end of image) */
+long zimgget(char *buf,unsigned long len)
+{
+	ssize_t k;
+	int r;
+
+	zin.next_out=(unsigned char *)buf;
+	zin.avail_out=len;
+	while(zin.avail_out==len) {
+		if(zin.avail_in==0&&!zeof) {	/* get more */
+			zbase+=zin.next_in-zinbase;
+			if((k=read(zfd,zinbuf,ZINLEN))<0) {
+				perror("?Error on read");
+				exit(1);
+			}
+			zeof=(k==0);
+			zin.next_in=zinbase=zinbuf;
+			zin.avail_in=k;
+		}
+		if(zin.avail_in==0) {	/* end of file */
+			if(zmember) corrupt();  /* truncated */
+			break;
+		}
+		/* anything but another member after the last one is taken */
+		/* to be junk (tape blocking, say) and ignored */
+		if(!zmember&&zin.next_in[0]!=037) {
+			zin.avail_in=0;
+			zeof=1;
+			continue;
+		}
+		zmember=1;
+		r=inflate(&zin,Z_NO_FLUSH);
+		if(r==Z_STREAM_END) {	/* end of member, maybe more */
+			inflateReset(&zin);
+			zmember=0;
+			if(zcur>=0) zcur++;
+		}
+		else if(r!=Z_OK) corrupt();
+	}
+	len-=zin.avail_out;
+	zpos+=len;
+	return(len);
+}
+
+/* go to offset POS of the image being read */
+void zimgseek(long long pos)
+{
+	static char scratch[ZINLEN];
+	long lo, hi, b;
+
+	if(nzblks<0) zblocks();		/* find out where the members are */
+	if(nzblks>0) {			/* find the member that has POS */
+		for(lo=0,hi=nzblks;hi-lo>1;) {
+			b=(lo+hi)/2;
+			if(zblks[b].upos<=pos) lo=b;
+			else hi=b;
+		}
+		/* start it over unless we're already in it (and before POS) */
+		if(lo!=zcur||pos<zpos) zrestart(zblks[lo].cpos,zblks[lo].upos);
+		zcur=lo;
+	}
+	else if(pos<zpos) zrestart(0,0);  /* plain gzip, from the top */
+
+	while(zpos<pos)			/* read up to POS */
+		if(zimgget(scratch,(pos-zpos<ZINLEN)?pos-zpos:ZINLEN)==0) {
+			fprintf(stderr,"?Unexpected end of file\n");
+			exit(1);
+		}
+}
+
+/* start decompressing again from file offset CPOS (image offset UPOS) */
+static void zrestart(long long cpos,long long upos)
+{
+	if(lseek(zfd,cpos,SEEK_SET)<0) {
+		perror("?Seek failed");
+		exit(1);
+	}
+	inflateReset(&zin);
+	zin.avail_in=0;
+	zin.next_in=zinbase=zinbuf;
+	zbase=cpos;
+	zeof=zmember=0;
+	zpos=upos;
+}
+
+/* make the list of members in zblks[], if the image is one we wrote */
+/* (hopping from header to header), otherwise set nzblks to 0 */
+static void zblocks()
+{
+	unsigned char h[HDRLEN];
+	unsigned long max=0;
+	long long c, u;
+	struct stat s;
+
+	nzblks=0;
+	if(fstat(zfd,&s)<0) {
+		perror("?Can't stat tape image");
+		exit(1);
+	}
+	for(c=u=0;c<s.st_size;) {
+		if(pread(zfd,h,HDRLEN,c)!=HDRLEN||
+			h[0]!=037||h[1]!=0213||h[2]!=8||h[3]!=4||
+			h[10]!=12||h[11]!=0||h[12]!='I'||h[13]!='T'||
+			h[14]!=8||h[15]!=0||get32(h+16)<HDRLEN+8) break;
+		if(nzblks>=max) {
+			max=max?max*2:1024;
+			if((zblks=realloc(zblks,max*sizeof(struct zblk)))==NULL)
+				nomem();
+		}
+		zblks[nzblks].cpos=c;
+		zblks[nzblks++].upos=u;
+		c+=get32(h+16);
+		u+=get32(h+20);
+	}
+	if(c<s.st_size) nzblks=0;  /* not all ours, treat it as plain gzip */
+	/* figure out which member we're in now (by its file offset) */
+	c=zbase+(zin.next_in-zinbase);
+	for(zcur=0;zcur<nzblks&&zblks[zcur].cpos<c;zcur++) ;
+	if(zmember||zcur>=nzblks||zblks[zcur].cpos!=c) zcur=(-1);
+}
+
+/* complain that the image is corrupt or cut short */
+static void corrupt()
+{
+	fprintf(stderr,"?Corrupt compressed tape image\n");
+	exit(1);
+}
+
+/* start writing a compressed image on FD, with THREADS compressor threads */
+/* (none means the main thread compresses the blocks itself) */
+void zimgout(int fd,int threads)
+{
+	int i;
+
+	zfd=fd;
+	nthreads=(threads>1)?threads:0;
+	nslots=nthreads?2*nthreads:1;
+	if((slots=calloc(nslots,sizeof(struct zslot)))==NULL) nomem();
+	for(i=0;i<nslots;i++) {
+		if((slots[i].in=malloc(ZBLOCK))==NULL) nomem();
+		if(deflateInit2(&slots[i].z,Z_DEFAULT_COMPRESSION,Z_DEFLATED,
+			-15,8,Z_DEFAULT_STRATEGY)!=Z_OK) nomem();
+	}
+	if(nthreads&&(zthreads=malloc(nthreads*sizeof(pthread_t)))==NULL)
+		nomem();
+	for(i=0;i<nthreads;i++)
+		if((errno=pthread_create(&zthreads[i],NULL,zthread,NULL))!=0) {
+			perror("?Can't start thread");
+			exit(1);
+		}
+}
+
+/* add LEN bytes from BUF[] to the image being written */
+void zimgput(const void *buf,unsigned long len)
+{
+	const unsigned char *p=buf;
+	struct zslot *s;
+	unsigned long n;
+
+	while(len) {
+		s=&slots[zfill%nslots];
+		n=ZBLOCK-s->n;
+		if(n>len) n=len;
+		memcpy(s->in+s->n,p,n);
+		s->n+=n;
+		p+=n;
+		len-=n;
+		if(s->n==ZBLOCK) zqueue();
+	}
+}
+
+/* finish writing the compressed image, and stop the threads */
+void zimgend()
+{
+	int i;
+
+	if(slots[zfill%nslots].n) zqueue();  /* partial last block */
+	pthread_mutex_lock(&zlock);
+	while(zwrote<zfill) {		/* write out the rest */
+		struct zslot *s=&slots[zwrote%nslots];
+		while(!s->done) pthread_cond_wait(&zdone,&zlock);
+		pthread_mutex_unlock(&zlock);
+		zwrite(s);
+		pthread_mutex_lock(&zlock);
+	}
+	zquit=1;
+	pthread_cond_broadcast(&zwork);
+	pthread_mutex_unlock(&zlock);
+	for(i=0;i<nthreads;i++) pthread_join(zthreads[i],NULL);
+}
+
+/* queue the block being filled to be compressed, and make sure the next */
+/* slot is free (writing out finished blocks until it is) */
+static void zqueue()
+{
+	struct zslot *s;
+
+	if(!nthreads) {			/* just do it */
+		s=&slots[zfill%nslots];
+		zcompress(s);
+		zfill++;
+		zwrite(s);
+		return;
+	}
+	pthread_mutex_lock(&zlock);
+	zfill++;
+	pthread_cond_signal(&zwork);
+	/* the next slot is free once the oldest block is written */
+	while(zfill-zwrote>=nslots) {
+		s=&slots[zwrote%nslots];
+		while(!s->done) pthread_cond_wait(&zdone,&zlock);
+		pthread_mutex_unlock(&zlock);
+		zwrite(s);
+		pthread_mutex_lock(&zlock);
+	}
+	pthread_mutex_unlock(&zlock);
+}
+
+/* write finished block S to the image, and free its slot */
+/* (called by the main thread only, so blocks are written in order) */
+static void zwrite(struct zslot *s)
+{
+	unsigned char *p;
+	unsigned long n;
+	ssize_t k;
+
+	for(p=s->out,n=s->outlen;n;p+=k,n-=k)
+		if((k=write(zfd,p,n))<=0) {
+			perror("?Error on write");
+			exit(1);
+		}
+	pthread_mutex_lock(&zlock);
+	s->n=0;
+	s->done=0;
+	zwrote++;
+	pthread_mutex_unlock(&zlock);
+}
+
+/* compressor thread, compress blocks until told to quit */
+static void *zthread(void *arg)
+{
+	struct zslot *s;
+
+	for(;;) {
+		pthread_mutex_lock(&zlock);
+		while(zcomp==zfill&&!zquit) pthread_cond_wait(&zwork,&zlock);
+		if(zcomp==zfill) {	/* quitting, and nothing left */
+			pthread_mutex_unlock(&zlock);
+			return(NULL);
+		}
+		s=&slots[zcomp++%nslots];
+		pthread_mutex_unlock(&zlock);
+
+		zcompress(s);
+
+		pthread_mutex_lock(&zlock);
+		s->done=1;
+		pthread_cond_signal(&zdone);
+		pthread_mutex_unlock(&zlock);
+	}
+}
+
+/* compress block S into a gzip member with our extra header field */
+static void zcompress(struct zslot *s)
+{
+	unsigned long max;
+	unsigned char *h;
+
+	max=HDRLEN+deflateBound(&s->z,s->n)+8;
+	if(max>s->outmax) {
+		if((s->out=realloc(s->out,max))==NULL) nomem();
+		s->outmax=max;
+	}
+	deflateReset(&s->z);
+	s->z.next_in=s->in;
+	s->z.avail_in=s->n;
+	s->z.next_out=s->out+HDRLEN;
+	s->z.avail_out=max-HDRLEN-8;
+	if(deflate(&s->z,Z_FINISH)!=Z_STREAM_END) {
+		fprintf(stderr,"?Error compressing tape image\n");
+		exit(1);
+	}
+	s->outlen=HDRLEN+s->z.total_out+8;
+
+	h=s->out;
+	h[0]=037;			/* magic */
+	h[1]=0213;
+	h[2]=8;				/* deflate */
+	h[3]=4;				/* FEXTRA */
+	put32(h+4,0);			/* no date */
+	h[8]=0;				/* no XFL */
+	h[9]=3;				/* UNIX */
+	h[10]=12;			/* XLEN */
+	h[11]=0;
+	h[12]='I';			/* our subfield */
+	h[13]='T';
+	h[14]=8;			/* its length */
+	h[15]=0;
+	put32(h+16,s->outlen);		/* length of member */
+	put32(h+20,s->n);		/* # image bytes in it */
+	h=s->out+s->outlen-8;
+	put32(h,crc32(0L,s->in,s->n));
+	put32(h+4,s->n);
+}
+
+/* store/fetch 32-bit little-endian numbers */
+static void put32(unsigned char *p,unsigned long n)
+{
+	p[0]=n&0377;
+	p[1]=(n>>8)&0377;
+	p[2]=(n>>16)&0377;
+	p[3]=(n>>24)&0377;
+}
+
+static unsigned long get32(unsigned char *p)
+{
+	return(p[0]|(p[1]<<8)|((unsigned long)p[2]<<16)|
+		((unsigned long)p[3]<<24));
+}
@@ -2,6 +2,19 @@
 
   Open an input file, decompressing it if needed.
 
+  A file is only taken to be compressed if its name ends in ".Z" or ".gz"
+  (or that had to be added to find it), so an ordinary file that happens
+  to start like one is read as is.  Files made by compress(1) (LZW) and
+  gzip(1) are then told apart by their magic numbers and decompressed on
+  the fly as they're read, through a stdio stream with our own read
+  routine, so the caller just sees the data (and nothing is written to
+  disk or deleted).  zstream() does the same for a stream that's already
+  open (e.g. STDIN), and zmemopen() for a file that has been read into
+  memory (e.g. a member of a tar archive).
+
+  Entry points:
+  zopen, zstream, zmemopen.
+
   By John Wilson.
 
   04/11/1993  JMBW  Created.
@@ -25,6 +38,8 @@
 
 */
 
+#define _GNU_SOURCE		/* for fopencookie() */
+#include <errno.h>
 #include <fcntl.h>
 #define zopen apple_zopen
 #include <stdio.h>
@@ -34,85 +49,430 @@
 #include <unistd.h>
 #include <sys/stat.h>
 #include <sys/types.h>
-#include <sys/wait.h>
+#include <zlib.h>
 
 #include "itstar.h"
 
-#define ZCAT "/bin/zcat"
-
 void nomem();
 
-static void uncompress(char *file);
+#define LZW 1			/* compress(1) format */
+#define GZIP 2			/* gzip(1) format */
+#define PLAIN 3			/* not compressed, but starts with 037 */
+
+#define ZBUFLEN (64*1024)	/* compressed data read at a time */
+#define BITS 16			/* biggest LZW code compress(1) makes */
+
+struct zfile {			/* one compressed file being read */
+	FILE *f;		/* the file */
+	char *name;		/* its name, for messages */
+	int type;		/* LZW or GZIP */
+	unsigned char in[ZBUFLEN+4];  /* compressed data (+ slop for LZW) */
+				/* or the bytes already read, if PLAIN */
+	long insize;		/* # bytes in IN */
+	int eof;		/* NZ => no more compressed data */
+	struct lzw *lzw;	/* LZW decoder, if LZW */
+	z_stream z;		/* zlib's inflate() state, if GZIP */
+	int zend;		/* NZ => at end of a gzip member */
+};
+
+struct lzw {			/* LZW decoder state (see lzwread()) */
+	int maxbits;		/* max code size, from header */
+	int block;		/* NZ => code 256 clears the table */
+	int nbits;		/* current code size */
+	long maxcode;		/* biggest code of that size */
+	long maxmaxcode;	/* 1<<MAXBITS */
+	long freeent;		/* next table entry */
+	long oldcode;		/* previous code, or -1 at start */
+	long posbits;		/* bit position of next code in IN */
+	long inbits;		/* # bits in IN that can be used */
+	int finchar;		/* first char of previous string */
+	unsigned short prefix[1<<BITS];  /* string table, each entry is */
+	unsigned char suffix[1<<BITS];	/* a previous entry plus a char */
+	unsigned char stack[1<<BITS];	/* current string, backwards */
+	unsigned char *sp;	/* chars waiting in STACK, to the end */
+};
+
+static void corrupt(struct zfile *);
+static long lzwread(struct zfile *, char *, long),
+	gzipread(struct zfile *, char *, long),
+	plainread(struct zfile *, char *, long);
+static void lzwfill(struct zfile *);
+
+#ifdef __GLIBC__
+static ssize_t zread(void *, char *, size_t), mread(void *, char *, size_t);
+#else
+static int zread(void *, char *, int), mread(void *, char *, int);
+#endif
+static int zclose(void *), mclose(void *);
+static int zname(char *);
+
+struct mfile {			/* one file in memory */
+	char *buf;		/* its contents (malloc()ed) */
+	size_t len;		/* its length */
+	size_t pos;		/* # bytes already read */
+};
 
 /* open a file for input, uncompressing it if needed, return NULL on failure */
 /* this is a bit tangled because either we have a filename supplied by the */
 /* user, which includes the ".Z" if it's compressed, or else we have a */
-/* filename read from DIR.LIST, which may or may not need to have ".Z" added */
+/* filename read from DIR.LIST, which may or may not need to have ".Z" (or */
+/* ".gz") added -- either way, only those names are decompressed */
 FILE *zopen(char *file)
 {
 	FILE *f;
-	int len;
-
-	/* see if name already ends in ".Z" */
-	len=strlen(file);
-	if(len>2&&file[len-2]=='.'&&file[len-1]=='Z') {
-		/* it does, trim that off (uncompress() adds it) */
-		char *name;
-		if((name=malloc(len-2+1))==NULL) nomem();
-		strncpy(name,file,len-2);	/* copy name */
-		name[len-2]='\0';		/* hack off ".Z" */
-		uncompress(name);		/* uncompress */
-		f=fopen(name,"rb");		/* open it */
+	char *name;
+	int e;
+
+	if((f=fopen(file,"rb"))==NULL) {  /* doesn't exist */
+		e=errno;		/* report that if all else fails */
+		if((name=malloc(strlen(file)+3+1))==NULL)  /* ".gz"<NUL> */
+			nomem();
+		sprintf(name,"%s.Z",file);
+		if((f=fopen(name,"rb"))==NULL) {
+			sprintf(name,"%s.gz",file);
+			f=fopen(name,"rb");
+		}
 		free(name);
-	}
-	else {		/* no ".Z", try opening it directly */
-		if((f=fopen(file,"rb"))==NULL) {  /* doesn't exist */
-			uncompress(file);	/* uncompress */
-			f=fopen(file,"rb");	/* one more try */
+		if(f==NULL) {
+			errno=e;
+			return(NULL);
 		}
 	}
-	return(f);
+	else if(!zname(file)) return(f);  /* found as is, not compressed */
+	return(zstream(f,file));
 }
 
-/* uncompress a file, or try anyway */
-static void uncompress(char *file)
+/* return a stream that reads F (called FILE) decompressed, or F itself */
+/* if it isn't compressed */
+/* (F may be a pipe, so if it starts with 037 but isn't compressed after */
+/* all, the stream gives back the bytes we looked at instead of seeking) */
+FILE *zstream(FILE *f,char *file)
 {
-	char *filez;
-	int h, hz;
-	int stat;
-	pid_t pid;
-
-	if((filez=malloc(strlen(file)+2+1))==NULL)  /* allow for ".Z"<0> */
-		nomem();
-	sprintf(filez,"%s.Z",file);
-	if((hz=open(filez,O_RDONLY,0))>=0) { /* .Z file exists */
-		if((h=creat(file,0644))<0) {
-			fprintf(stderr,"?Can't create %s\n",file);
+	struct zfile *z;
+	FILE *s;
+	int c, type;
+
+	/* check magic number */
+	if((c=getc(f))!=037) {		/* (both formats start with 037) */
+		if(c!=EOF) ungetc(c,f);
+		return(f);
+	}
+	c=getc(f);
+	if(c==0235) type=LZW;
+	else if(c==0213) type=GZIP;
+	else type=PLAIN;		/* neither */
+
+	if((z=malloc(sizeof(struct zfile)))==NULL) nomem();
+	if((z->name=strdup(file))==NULL) nomem();
+	z->f=f;
+	z->type=type;
+	z->eof=0;
+	z->lzw=NULL;
+
+	if(type==LZW) {
+		struct lzw *l;
+
+		if((l=z->lzw=malloc(sizeof(struct lzw)))==NULL) nomem();
+		if((c=getc(f))==EOF) corrupt(z);
+		l->maxbits=c&037;
+		l->block=c&0200;
+		if(l->maxbits<9||l->maxbits>BITS) {
+			fprintf(stderr,"?%s compressed with %d bits, can't "
+				"handle more than %d\n",file,l->maxbits,BITS);
 			exit(1);
 		}
-		if((pid=fork())<0) {
-			perror("?Failed to create child process");
-			exit(1);
+		l->maxmaxcode=1L<<l->maxbits;
+		l->nbits=9;
+		l->maxcode=(1L<<l->nbits)-1;
+		l->freeent=l->block?257:256;
+		l->oldcode=-1;
+		l->finchar=0;
+		for(c=0;c<256;c++) l->prefix[c]=0, l->suffix[c]=c;
+		l->sp=l->stack+sizeof(l->stack);  /* nothing waiting */
+		z->insize=0;
+		l->posbits=l->inbits=0;
+	}
+	else if(type==GZIP) {
+		/* give zlib the magic number back, it wants the whole header */
+		z->in[0]=037, z->in[1]=0213;
+		z->z.next_in=z->in;
+		z->z.avail_in=2;
+		z->z.zalloc=Z_NULL, z->z.zfree=Z_NULL, z->z.opaque=Z_NULL;
+		if(inflateInit2(&z->z,16+MAX_WBITS)!=Z_OK) nomem();
+		z->zend=0;
+	}
+	else {				/* see plainread() */
+		z->in[0]=037;
+		z->insize=1;
+		if(c!=EOF) z->in[z->insize++]=c;
+	}
+
+#ifdef __GLIBC__
+	{
+		cookie_io_functions_t io={ zread, NULL, NULL, zclose };
+		s=fopencookie(z,"rb",io);
+	}
+#else
+	s=funopen(z,zread,NULL,NULL,zclose);
+#endif
+	if(s==NULL) nomem();
+	return(s);
+}
+
+/* return a stream that reads the LEN bytes at BUF (malloc()ed, and freed */
+/* when the stream is closed) that were read from FILE, decompressing them */
+/* if FILE's name says they're compressed */
+FILE *zmemopen(char *buf,size_t len,char *file)
+{
+	struct mfile *m;
+	FILE *s;
+
+	if((m=malloc(sizeof(struct mfile)))==NULL) nomem();
+	m->buf=buf;
+	m->len=len;
+	m->pos=0;
+#ifdef __GLIBC__
+	{
+		cookie_io_functions_t io={ mread, NULL, NULL, mclose };
+		s=fopencookie(m,"rb",io);
+	}
+#else
+	s=funopen(m,mread,NULL,NULL,mclose);
+#endif
+	if(s==NULL) nomem();
+	if(zname(file)) return(zstream(s,file));
+	return(s);
+}
+
+/* return NZ if FILE's name ends in ".Z" or ".gz" */
+static int zname(char *file)
+{
+	size_t n=strlen(file);
+
+	return((n>2&&strcmp(file+n-2,".Z")==0)||
+		(n>3&&strcmp(file+n-3,".gz")==0));
+}
+
+/* stdio read routine for files in memory, read SIZE bytes into BUF */
+#ifdef __GLIBC__
+static ssize_t mread(void *cookie,char *buf,size_t size)
+#else
+static int mread(void *cookie,char *buf,int size)
+#endif
+{
+	struct mfile *m=cookie;
+
+	if(size>m->len-m->pos) size=m->len-m->pos;
+	memcpy(buf,m->buf+m->pos,size);
+	m->pos+=size;
+	return(size);
+}
+
+/* stdio close routine for files in memory */
+static int mclose(void *cookie)
+{
+	struct mfile *m=cookie;
+
+	free(m->buf);
+	free(m);
+	return(0);
+}
+
+/* stdio read routine for zstream(), read SIZE bytes into BUF */
+#ifdef __GLIBC__
+static ssize_t zread(void *cookie,char *buf,size_t size)
+#else
+static int zread(void *cookie,char *buf,int size)
+#endif
+{
+	struct zfile *z=cookie;
+
+	if(z->type==LZW) return(lzwread(z,buf,size));
+	else if(z->type==GZIP) return(gzipread(z,buf,size));
+	else return(plainread(z,buf,size));
+}
+
+/* stdio close routine for zstream() */
+static int zclose(void *cookie)
+{
+	struct zfile *z=cookie;
+	int rc;
+
+	rc=fclose(z->f);
+	if(z->type==GZIP) inflateEnd(&z->z);
+	free(z->lzw);
+	free(z->name);
+	free(z);
+	return(rc);
+}
+
+/* read up to SIZE bytes of uncompressed file Z into BUF, return # bytes */
+/* (the bytes zstream() read to check the magic number come first) */
+static long plainread(struct zfile *z,char *buf,long size)
+{
+	long n, k;
+
+	n=z->insize<size?z->insize:size;
+	memcpy(buf,z->in,n);
+	memmove(z->in,z->in+n,z->insize-n);
+	z->insize-=n;
+	k=fread(buf+n,1,size-n,z->f);
+	if(n==0&&k==0&&ferror(z->f)) return(-1);
+	return(n+k);
+}
+
+/* complain about a compressed file that can't be decompressed */
+static void corrupt(struct zfile *z)
+{
+	fprintf(stderr,"?Corrupt compressed file:  %s\n",z->name);
+	exit(1);
+}
+
+/* decompress up to SIZE bytes of LZW file Z into BUF, return # bytes */
+/* this is the same algorithm as compress(1), with its quirks:  codes come */
+/* in groups of 8 (i.e. NBITS bytes), and when the code size changes or the */
+/* table is cleared, the rest of the current group is skipped */
+static long lzwread(struct zfile *z,char *buf,long size)
+{
+	register struct lzw *l=z->lzw;
+	register unsigned char *p;
+	register long code;
+	long incode, n, k;
+
+	for(n=0;n<size;) {
+		/* send whatever's left of the last string first */
+		if(l->sp<l->stack+sizeof(l->stack)) {
+			k=l->stack+sizeof(l->stack)-l->sp;
+			if(k>size-n) k=size-n;
+			memcpy(buf+n,l->sp,k);
+			l->sp+=k, n+=k;
+			continue;
 		}
-		if(!pid) {	/* child process */
-			static char *argv[] = { "zcat", NULL };
-			static char *envp[] = { NULL };
-			/* use STDIN/STDOUT instead of JCL */
-			/* so "-read-.-this-" won't annoy zcat */
-			dup2(hz,0), close(hz); /* STDIN */
-			dup2(h,1), close(h); /* STDOUT */
-			execve(ZCAT,argv,envp);
-			/* shouldn't have survived execve() */
-			perror(ZCAT);
-			exit(127);
+
+		if(l->posbits>=l->inbits) {	/* need more input */
+			if(z->eof) break;	/* that's all */
+			lzwfill(z);
+			continue;
 		}
-		close(hz), close(h);
-		wait(&stat);
-		if(WEXITSTATUS(stat) != 0) { /* non-zero RC */
-			fprintf(stderr,"?Error uncompressing %s\n",filez);
-			exit(1);
+
+		if(l->freeent>l->maxcode) {	/* codes get bigger */
+			l->posbits=(l->posbits-1)+((l->nbits<<3)-
+				(l->posbits-1+(l->nbits<<3))%(l->nbits<<3));
+			l->nbits++;
+			l->maxcode=(l->nbits==l->maxbits)?l->maxmaxcode:
+				(1L<<l->nbits)-1;
+			lzwfill(z);
+			continue;
+		}
+
+		/* get the next code (low bits first) */
+		p=z->in+(l->posbits>>3);
+		code=(((long)p[0]|((long)p[1]<<8)|((long)p[2]<<16))>>
+			(l->posbits&7))&((1L<<l->nbits)-1);
+		l->posbits+=l->nbits;
+
+		if(l->oldcode==-1) {		/* first code is just a char */
+			if(code>=256) corrupt(z);
+			l->finchar=l->oldcode=code;
+			*--l->sp=code;
+			continue;
+		}
+
+		if(code==256&&l->block) {	/* clear table */
+			memset(l->prefix,0,256*sizeof(l->prefix[0]));
+			l->freeent=256;
+			l->posbits=(l->posbits-1)+((l->nbits<<3)-
+				(l->posbits-1+(l->nbits<<3))%(l->nbits<<3));
+			l->nbits=9;
+			l->maxcode=(1L<<l->nbits)-1;
+			lzwfill(z);
+			continue;
+		}
+
+		/* unwind the string backwards onto STACK */
+		incode=code;
+		if(code>=l->freeent) {	/* KwKwK case, code being defined */
+			if(code>l->freeent) corrupt(z);
+			*--l->sp=l->finchar;
+			code=l->oldcode;
+		}
+		while(code>=256) {
+			*--l->sp=l->suffix[code];
+			code=l->prefix[code];
+		}
+		*--l->sp=l->finchar=l->suffix[code];
+
+		/* new table entry is previous string plus this first char */
+		if((code=l->freeent)<l->maxmaxcode) {
+			l->prefix[code]=l->oldcode;
+			l->suffix[code]=l->finchar;
+			l->freeent=code+1;
+		}
+		l->oldcode=incode;
+	}
+	return(n);
+}
+
+/* throw away the bytes of IN before the current LZW code, and read more */
+/* set INBITS to the number of bits we can use before calling again */
+static void lzwfill(struct zfile *z)
+{
+	struct lzw *l=z->lzw;
+	long o, n;
+
+	o=l->posbits>>3;		/* keep from here on */
+	n=(o<=z->insize)?z->insize-o:0;
+	memmove(z->in,z->in+o,n);
+	z->insize=n;
+	l->posbits=0;
+
+	n=fread(z->in+z->insize,1,ZBUFLEN-z->insize,z->f);
+	if(ferror(z->f)) {
+		perror(z->name);
+		exit(1);
+	}
+	z->insize+=n;
+	if(n==0&&z->insize<ZBUFLEN) {	/* end of file, use it all */
+		z->eof=1;
+		l->inbits=(z->insize<<3)-(l->nbits-1);
+	}
+	else l->inbits=(z->insize-z->insize%l->nbits)<<3;  /* whole groups */
+}
+
+/* decompress up to SIZE bytes of gzip file Z into BUF, return # bytes */
+static long gzipread(struct zfile *z,char *buf,long size)
+{
+	int rc;
+
+	z->z.next_out=(unsigned char *)buf;
+	z->z.avail_out=size;
+	while(z->z.avail_out>0) {
+		if(z->z.avail_in==0) {	/* need more input */
+			if(z->eof) break;
+			z->z.avail_in=fread(z->in,1,ZBUFLEN,z->f);
+			z->z.next_in=z->in;
+			if(ferror(z->f)) {
+				perror(z->name);
+				exit(1);
+			}
+			if(z->z.avail_in==0) {	/* end of file */
+				if(!z->zend) corrupt(z);  /* in mid-member */
+				z->eof=1;
+				break;
+			}
+		}
+		rc=inflate(&z->z,Z_NO_FLUSH);
+		if(rc==Z_STREAM_END) {	/* another member may follow */
+			z->zend=1;
+			inflateReset(&z->z);
+		}
+		else if(rc==Z_OK) z->zend=0;
+		else if(z->zend) {	/* junk after last member, like gzip */
+			z->eof=1;	/* (ignore it) */
+			z->z.avail_in=0;
+			break;
 		}
-		unlink(filez); /* delete file.Z */
-		free(filez);
+		else corrupt(z);
 	}
+	return(size-z->z.avail_out);
 }